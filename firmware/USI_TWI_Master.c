@@ -27,11 +27,17 @@
 *
 ****************************************************************************/
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "USI_TWI_Master.h"
 #include <util/delay.h>
 
+unsigned char USI_TWI_Master_Transceive( unsigned char *, unsigned char, unsigned char );
 unsigned char USI_TWI_Master_Transfer( unsigned char );
 unsigned char USI_TWI_Master_Stop( void );
+static unsigned char USI_TWI_Wait_SCL( void );
+static void USI_TWI_Bus_Clear( void );
+
+static unsigned char USI_TWI_timedOut;     // An SCL wait gave up
 
 union  USI_TWI_state
 {
@@ -40,7 +46,8 @@ union  USI_TWI_state
   {
     unsigned char addressMode         : 1;
     unsigned char masterWriteDataMode : 1;
-    unsigned char unused              : 6;
+    unsigned char memReadMode         : 1;
+    unsigned char unused              : 5;
   };
 }   USI_TWI_state;
 
@@ -85,13 +92,36 @@ unsigned char USI_TWI_Get_State_Info( void )
 ---------------------------------------------------------------*/
 unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char *msg, unsigned char msgSize)
 {
+  return USI_TWI_Master_Transceive( msg, msgSize, FALSE );
+}
+
+/*---------------------------------------------------------------
+ Register read in one transaction. The first byte is the slave
+ address, the second the register to read from. The register
+ address is written, and after a repeated Start Condition
+ msgSize-1 bytes are read back into msg[1] onwards.
+---------------------------------------------------------------*/
+unsigned char USI_TWI_Start_Random_Read( unsigned char *msg, unsigned char msgSize)
+{
+  return USI_TWI_Master_Transceive( msg, msgSize, TRUE );
+}
+
+unsigned char USI_TWI_Master_Transceive( unsigned char *msg, unsigned char msgSize, unsigned char memRead )
+{
+  unsigned char *savedMsg = msg;
+  unsigned char savedMsgSize = msgSize;
+
   unsigned char tempUSISR_8bit = (1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|      // Prepare register value to: Clear flags, and
                                  (0x0<<USICNT0);                                     // set USI to shift 8 bits i.e. count 16 clock edges.
   unsigned char tempUSISR_1bit = (1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|      // Prepare register value to: Clear flags, and
                                  (0xE<<USICNT0);                                     // set USI to shift 1 bit i.e. count 2 clock edges.
 
+  while( USI_TWI_Busy() );                          // Let queued transactions finish first.
+
+  USI_TWI_timedOut = FALSE;
   USI_TWI_state.errorState = 0;
   USI_TWI_state.addressMode = TRUE;
+  USI_TWI_state.memReadMode = memRead;
 
 #ifdef PARAM_VERIFICATION
   if(msg > (unsigned char*)RAMEND)                 // Test if address is outside SRAM space
@@ -124,23 +154,31 @@ unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char *msg, unsigned
   }
 #endif
 
+  if ( USI_TWI_state.memReadMode )                  // Write the register address first.
+  {
+    *msg &= ~(1<<TWI_READ_BIT);
+    msgSize = 2;
+  }
+
   if ( !(*msg & (1<<TWI_READ_BIT)) )                // The LSB in the address byte determines if is a masterRead or masterWrite operation.
   {
     USI_TWI_state.masterWriteDataMode = TRUE;
   }
 
 /* Release SCL to ensure that (repeated) Start can be performed */
+start:
   PORT_USI |= (1<<PIN_USI_SCL);                     // Release SCL.
-  while( !(PIN_USI & (1<<PIN_USI_SCL)) );          // Verify that SCL becomes high.
-#ifdef TWI_FAST_MODE
-  _delay_us( T4_TWI/4 );                         // Delay for T4TWI if TWI_FAST_MODE
+  if( !USI_TWI_Wait_SCL() )                         // Verify that SCL becomes high.
+    goto timeout;
+#if defined(TWI_FAST_MODE) || defined(TWI_FAST_PLUS_MODE)
+  __builtin_avr_delay_cycles( T4_TWI );          // Delay for T4TWI if TWI_FAST_MODE
 #else
-  _delay_us( T2_TWI/4 );                         // Delay for T2TWI if TWI_STANDARD_MODE
+  __builtin_avr_delay_cycles( T2_TWI );          // Delay for T2TWI if TWI_STANDARD_MODE
 #endif
 
 /* Generate Start Condition */
   PORT_USI &= ~(1<<PIN_USI_SDA);                    // Force SDA LOW.
-  _delay_us( T4_TWI/4 );
+  __builtin_avr_delay_cycles( T4_TWI );
   PORT_USI &= ~(1<<PIN_USI_SCL);                    // Pull SCL LOW.
   PORT_USI |= (1<<PIN_USI_SDA);                     // Release SDA.
 
@@ -162,11 +200,15 @@ unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char *msg, unsigned
       PORT_USI &= ~(1<<PIN_USI_SCL);                // Pull SCL LOW.
       USIDR     = *(msg++);                        // Setup data.
       USI_TWI_Master_Transfer( tempUSISR_8bit );    // Send 8 bits on bus.
+      if( USI_TWI_timedOut )
+        goto timeout;
 
       /* Clock and verify (N)ACK from slave */
       DDR_USI  &= ~(1<<PIN_USI_SDA);                // Enable SDA as input.
       if( USI_TWI_Master_Transfer( tempUSISR_1bit ) & (1<<TWI_NACK_BIT) )
       {
+        if( USI_TWI_timedOut )
+          goto timeout;
         if ( USI_TWI_state.addressMode )
           USI_TWI_state.errorState = USI_TWI_NO_ACK_ON_ADDRESS;
         else
@@ -181,6 +223,8 @@ unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char *msg, unsigned
       /* Read a data byte */
       DDR_USI   &= ~(1<<PIN_USI_SDA);               // Enable SDA as input.
       *(msg++)  = USI_TWI_Master_Transfer( tempUSISR_8bit );
+      if( USI_TWI_timedOut )
+        goto timeout;
 
       /* Prepare to generate ACK (or NACK in case of End Of Transmission) */
       if( msgSize == 1)                            // If transmission of last byte was performed.
@@ -192,13 +236,33 @@ unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char *msg, unsigned
         USIDR = 0x00;                              // Load ACK. Set data register bit 7 (output for SDA) low.
       }
       USI_TWI_Master_Transfer( tempUSISR_1bit );   // Generate ACK/NACK.
+      if( USI_TWI_timedOut )
+        goto timeout;
     }
   }while( --msgSize) ;                             // Until all data sent/received.
 
-  USI_TWI_Master_Stop();                           // Send a STOP condition on the TWI bus.
+  if ( USI_TWI_state.memReadMode )                  // Register address written, read it back
+  {                                                 // after a Repeated Start, without a Stop.
+    USI_TWI_state.memReadMode = FALSE;
+    USI_TWI_state.masterWriteDataMode = FALSE;
+    USI_TWI_state.addressMode = TRUE;
+    msg = savedMsg;
+    msgSize = savedMsgSize;
+    *msg |= (1<<TWI_READ_BIT);
+    goto start;
+  }
+
+  if( !USI_TWI_Master_Stop() )                     // Send a STOP condition on the TWI bus.
+    return (FALSE);
 
 /* Transmission successfully completed*/
   return (TRUE);
+
+/* SCL stuck low: give up and free the bus */
+timeout:
+  USI_TWI_Bus_Clear();
+  USI_TWI_state.errorState = USI_TWI_BUS_TIMEOUT;
+  return (FALSE);
 }
 
 /*---------------------------------------------------------------
@@ -216,14 +280,15 @@ unsigned char USI_TWI_Master_Transfer( unsigned char temp )
            (1<<USITC);                              // Toggle Clock Port.
   do
   {
-    _delay_us( T2_TWI/4 );
+    __builtin_avr_delay_cycles( T2_TWI );
     USICR = temp;                          // Generate positve SCL edge.
-    while( !(PIN_USI & (1<<PIN_USI_SCL)) );// Wait for SCL to go high.
-    _delay_us( T4_TWI/4 );
+    if( !USI_TWI_Wait_SCL() )              // Wait for SCL to go high.
+      return 0xFF;
+    __builtin_avr_delay_cycles( T4_TWI );
     USICR = temp;                          // Generate negative SCL edge.
   }while( !(USISR & (1<<USIOIF)) );        // Check for transfer complete.
 
-  _delay_us( T2_TWI/4 );
+  __builtin_avr_delay_cycles( T2_TWI );
   temp  = USIDR;                           // Read out data.
   USIDR = 0xFF;                            // Release SDA.
   DDR_USI |= (1<<PIN_USI_SDA);             // Enable SDA as output.
@@ -239,10 +304,15 @@ unsigned char USI_TWI_Master_Stop( void )
 {
   PORT_USI &= ~(1<<PIN_USI_SDA);           // Pull SDA low.
   PORT_USI |= (1<<PIN_USI_SCL);            // Release SCL.
-  while( !(PIN_USI & (1<<PIN_USI_SCL)) );  // Wait for SCL to go high.
-  _delay_us( T4_TWI/4 );
+  if( !USI_TWI_Wait_SCL() )                // Wait for SCL to go high.
+  {
+    USI_TWI_Bus_Clear();
+    USI_TWI_state.errorState = USI_TWI_BUS_TIMEOUT;
+    return (FALSE);
+  }
+  __builtin_avr_delay_cycles( T4_TWI );
   PORT_USI |= (1<<PIN_USI_SDA);            // Release SDA.
-  _delay_us( T2_TWI/4 );
+  __builtin_avr_delay_cycles( T2_TWI );
 
 #ifdef SIGNAL_VERIFY
   if( !(USISR & (1<<USIPF)) )
@@ -254,3 +324,408 @@ unsigned char USI_TWI_Master_Stop( void )
 
   return (TRUE);
 }
+
+/*---------------------------------------------------------------
+ Wait for SCL to go high, as a slave may stretch it. Returns FALSE
+ and sets USI_TWI_timedOut after USI_TWI_TIMEOUT_US.
+---------------------------------------------------------------*/
+static unsigned char USI_TWI_Wait_SCL( void )
+{
+  unsigned int wait = USI_TWI_TIMEOUT_US;
+
+  while( !(PIN_USI & (1<<PIN_USI_SCL)) )
+  {
+    if( --wait == 0 )
+    {
+      USI_TWI_timedOut = TRUE;
+      return (FALSE);
+    }
+    __builtin_avr_delay_cycles( F_CPU / 1000000 );  // About a microsecond per check.
+  }
+  return (TRUE);
+}
+
+/*---------------------------------------------------------------
+ Free a bus left in the middle of a byte: clock SCL until the
+ slave lets go of SDA, nine times at most, then send a Stop
+ Condition. SCL is not waited on, in case it is what's stuck.
+---------------------------------------------------------------*/
+static void USI_TWI_Bus_Clear( void )
+{
+  unsigned char i;
+
+  USICR    = (1<<USIWM1)|(0<<USIWM0)|(1<<USICS1)|(0<<USICS0)|(1<<USICLK);
+  USISR    = (1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC);  // Clear flags, and the SCL hold.
+  USIDR    = 0xFF;                        // Release SDA.
+  DDR_USI |= (1<<PIN_USI_SDA);
+  PORT_USI |= (1<<PIN_USI_SDA);
+
+  for( i = 0; i < 9 && !(PIN_USI & (1<<PIN_USI_SDA)); i++ )
+  {
+    PORT_USI &= ~(1<<PIN_USI_SCL);        // Pull SCL LOW.
+    __builtin_avr_delay_cycles( T2_TWI );
+    PORT_USI |= (1<<PIN_USI_SCL);         // Release SCL.
+    __builtin_avr_delay_cycles( T2_TWI );
+  }
+
+  PORT_USI &= ~(1<<PIN_USI_SCL);          // Stop Condition: SDA rises
+  __builtin_avr_delay_cycles( T2_TWI );   // while SCL is high.
+  PORT_USI &= ~(1<<PIN_USI_SDA);
+  __builtin_avr_delay_cycles( T2_TWI );
+  PORT_USI |= (1<<PIN_USI_SCL);
+  __builtin_avr_delay_cycles( T4_TWI );
+  PORT_USI |= (1<<PIN_USI_SDA);
+  __builtin_avr_delay_cycles( T2_TWI );
+}
+
+/*---------------------------------------------------------------
+ Interrupt driven transactions. Messages have the same layout as
+ for USI_TWI_Start_Transceiver_With_Data(), and must stay valid
+ until the callback has been called.
+
+ Timer1 compare B generates each SCL edge, and the start and stop
+ conditions. The USI counter overflow interrupt fires after each
+ byte or (N)ACK bit, and sets up the next one.
+---------------------------------------------------------------*/
+#define USICR_ASYNC ((0<<USISIE)|(1<<USIOIE)|                       /* Overflow interrupt enabled */ \
+                     (1<<USIWM1)|(0<<USIWM0)|                       /* Two-wire mode */ \
+                     (1<<USICS1)|(0<<USICS0)|(1<<USICLK))           /* Software clock strobe */
+#define USICR_IDLE  ((1<<USIWM1)|(0<<USIWM0)|(1<<USICS1)|(0<<USICS0)|(1<<USICLK))
+#define USISR_8BIT  ((1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|(0x0<<USICNT0))
+#define USISR_1BIT  ((1<<USISIF)|(1<<USIOIF)|(1<<USIPF)|(1<<USIDC)|(0xE<<USICNT0))
+
+enum
+{
+  ASYNC_IDLE,
+  ASYNC_START,        // Release SCL for a start condition
+  ASYNC_START_SDA,    // Setup time elapsed, pull SDA low
+  ASYNC_ADDRESS,      // Hold time elapsed, start shifting the address
+  ASYNC_SEND,         // Shifting a byte out
+  ASYNC_ACK_IN,       // Clocking in (N)ACK from slave
+  ASYNC_RECEIVE,      // Shifting a byte in
+  ASYNC_ACK_OUT,      // Clocking out (N)ACK to slave
+  ASYNC_STOP,         // Generate stop condition
+  ASYNC_STOP_SCL,
+  ASYNC_STOP_SDA,
+  ASYNC_CLEAR         // Clocking SCL until the slave releases SDA
+};
+
+struct USI_TWI_Transaction
+{
+  unsigned char   *msg;
+  unsigned char    msgSize;
+  unsigned char    memRead;
+  USI_TWI_Callback done;
+};
+
+static struct USI_TWI_Transaction USI_TWI_queue[USI_TWI_QUEUE_SIZE];
+static volatile unsigned char     USI_TWI_queueHead;  // Active transaction
+static volatile unsigned char     USI_TWI_queueCount;
+static volatile unsigned char     USI_TWI_asyncPhase;
+static unsigned char             *USI_TWI_asyncMsg;
+static unsigned char              USI_TWI_asyncLeft;  // Bytes left, including the address
+static unsigned char              USI_TWI_asyncRead;
+static unsigned char              USI_TWI_asyncAddress;  // Address byte is being sent
+static unsigned char              USI_TWI_asyncRestart;  // Repeated Start after this write
+static unsigned char              USI_TWI_asyncError;
+static unsigned char              USI_TWI_asyncStretch;  // Edges SCL has been held low for
+
+/*---------------------------------------------------------------
+ Keep the next compare match ahead of Timer1. A tick that ran
+ late can leave OCR1B behind TCNT1, and the match would then not
+ come round again until the timer wraps. Called with interrupts
+ disabled.
+---------------------------------------------------------------*/
+static void USI_TWI_Async_Rearm( void )
+{
+  if( (int16_t)(OCR1B - TCNT1) <= 0 )
+    OCR1B = TCNT1 + USI_TWI_HALF_PERIOD;
+}
+
+/*---------------------------------------------------------------
+ Start the transaction at the head of the queue. Called with
+ interrupts disabled.
+---------------------------------------------------------------*/
+static void USI_TWI_Async_Begin( void )
+{
+  struct USI_TWI_Transaction *t = &USI_TWI_queue[USI_TWI_queueHead];
+
+  USI_TWI_asyncMsg     = t->msg;
+  USI_TWI_asyncLeft    = t->msgSize;
+  USI_TWI_asyncRestart = t->memRead;
+  if( t->memRead )                                  // Write the register address first.
+  {
+    *t->msg &= ~(1<<TWI_READ_BIT);
+    USI_TWI_asyncLeft = 2;
+  }
+  USI_TWI_asyncRead  = *t->msg & (1<<TWI_READ_BIT);
+  USI_TWI_asyncError = 0;
+  USI_TWI_asyncStretch = 0;
+  USI_TWI_asyncPhase = ASYNC_START;
+
+  OCR1B   = TCNT1 + USI_TWI_HALF_PERIOD;
+  TIFR1   = (1<<OCF1B);                             // Clear any stale compare match.
+  USI_TWI_Async_Rearm();                            // In case it matched before the clear.
+  TIMSK1 |= (1<<OCIE1B);
+}
+
+/*---------------------------------------------------------------
+ Report the active transaction and move on to the next one.
+ Called from interrupt context.
+---------------------------------------------------------------*/
+static void USI_TWI_Async_Finish( void )
+{
+  USI_TWI_Callback done = USI_TWI_queue[USI_TWI_queueHead].done;
+
+  USICR = USICR_IDLE;                               // Disable overflow interrupt.
+  if( ++USI_TWI_queueHead >= USI_TWI_QUEUE_SIZE )
+    USI_TWI_queueHead = 0;
+  USI_TWI_queueCount--;
+
+  if( done )
+    done( USI_TWI_asyncError );
+
+  if( USI_TWI_queueCount )
+  {
+    USI_TWI_Async_Begin();
+  }
+  else
+  {
+    USI_TWI_asyncPhase = ASYNC_IDLE;
+    TIMSK1 &= ~(1<<OCIE1B);
+  }
+}
+
+/*---------------------------------------------------------------
+ Queue a transaction. Returns FALSE if the queue is full.
+---------------------------------------------------------------*/
+static unsigned char USI_TWI_Queue( unsigned char *msg, unsigned char msgSize, unsigned char memRead, USI_TWI_Callback done )
+{
+  unsigned char sreg = SREG;
+  unsigned char slot;
+
+  cli();
+  if( USI_TWI_queueCount >= USI_TWI_QUEUE_SIZE )
+  {
+    SREG = sreg;
+    return (FALSE);
+  }
+
+  slot = USI_TWI_queueHead + USI_TWI_queueCount;
+  if( slot >= USI_TWI_QUEUE_SIZE )
+    slot -= USI_TWI_QUEUE_SIZE;
+  USI_TWI_queue[slot].msg     = msg;
+  USI_TWI_queue[slot].msgSize = msgSize;
+  USI_TWI_queue[slot].memRead = memRead;
+  USI_TWI_queue[slot].done    = done;
+
+  if( USI_TWI_queueCount++ == 0 )
+    USI_TWI_Async_Begin();
+
+  SREG = sreg;
+  return (TRUE);
+}
+
+unsigned char USI_TWI_Queue_Transceiver_With_Data( unsigned char *msg, unsigned char msgSize, USI_TWI_Callback done )
+{
+  return USI_TWI_Queue( msg, msgSize, FALSE, done );
+}
+
+/*---------------------------------------------------------------
+ Queued version of USI_TWI_Start_Random_Read().
+---------------------------------------------------------------*/
+unsigned char USI_TWI_Queue_Random_Read( unsigned char *msg, unsigned char msgSize, USI_TWI_Callback done )
+{
+  return USI_TWI_Queue( msg, msgSize, TRUE, done );
+}
+
+/*---------------------------------------------------------------
+ TRUE while any queued transaction has not yet finished.
+---------------------------------------------------------------*/
+unsigned char USI_TWI_Busy( void )
+{
+  return ( USI_TWI_queueCount != 0 );
+}
+
+/*---------------------------------------------------------------
+ Count an edge spent waiting for SCL. Past the timeout, abandon
+ the transaction and start clearing the bus. Called from
+ interrupt context.
+---------------------------------------------------------------*/
+static void USI_TWI_Async_Stretched( void )
+{
+  if( ++USI_TWI_asyncStretch < USI_TWI_TIMEOUT_EDGES )
+    return;
+  USI_TWI_asyncStretch = 0;
+  USI_TWI_asyncError = USI_TWI_BUS_TIMEOUT;
+  if( USI_TWI_asyncPhase == ASYNC_STOP_SDA )        // Clearing needs SCL, which is stuck.
+  {
+    PORT_USI |= (1<<PIN_USI_SDA);
+    USI_TWI_Async_Finish();
+    return;
+  }
+  USICR = USICR_IDLE;                               // Take SCL back from the USI.
+  USISR = USISR_8BIT;                               // Clear flags, and the SCL hold.
+  USIDR = 0xFF;                                     // Release SDA.
+  DDR_USI |= (1<<PIN_USI_SDA);
+  PORT_USI |= (1<<PIN_USI_SDA);
+  USI_TWI_asyncLeft  = 9;                           // SCL pulses at most.
+  USI_TWI_asyncPhase = ASYNC_CLEAR;
+}
+
+/*---------------------------------------------------------------
+ Half SCL period tick: one clock edge, or one step of a start or
+ stop condition.
+---------------------------------------------------------------*/
+ISR( TIM1_COMPB_vect )
+{
+  OCR1B += USI_TWI_HALF_PERIOD;
+  USI_TWI_Async_Rearm();
+
+  switch( USI_TWI_asyncPhase )
+  {
+    case ASYNC_START:
+      PORT_USI |= (1<<PIN_USI_SCL);                 // Release SCL.
+      if( !(PIN_USI & (1<<PIN_USI_SCL)) )           // Wait for SCL to go high.
+      {
+        USI_TWI_Async_Stretched();
+        break;
+      }
+      USI_TWI_asyncStretch = 0;
+      USI_TWI_asyncPhase = ASYNC_START_SDA;         // SCL high for tSU;STA first.
+      break;
+
+    case ASYNC_START_SDA:
+      PORT_USI &= ~(1<<PIN_USI_SDA);                // Force SDA LOW.
+      USI_TWI_asyncPhase = ASYNC_ADDRESS;
+      break;
+
+    case ASYNC_ADDRESS:
+      PORT_USI &= ~(1<<PIN_USI_SCL);                // Pull SCL LOW.
+      PORT_USI |= (1<<PIN_USI_SDA);                 // Release SDA.
+      USIDR = *(USI_TWI_asyncMsg++);                // Setup address.
+      USI_TWI_asyncAddress = TRUE;
+      USISR = USISR_8BIT;
+      USICR = USICR_ASYNC;
+      USI_TWI_asyncPhase = ASYNC_SEND;
+      break;
+
+    case ASYNC_STOP:
+      PORT_USI &= ~(1<<PIN_USI_SDA);                // Pull SDA low.
+      USI_TWI_asyncPhase = ASYNC_STOP_SCL;
+      break;
+
+    case ASYNC_STOP_SCL:
+      PORT_USI |= (1<<PIN_USI_SCL);                 // Release SCL.
+      USI_TWI_asyncPhase = ASYNC_STOP_SDA;
+      break;
+
+    case ASYNC_STOP_SDA:
+      if( !(PIN_USI & (1<<PIN_USI_SCL)) )           // Wait for SCL to go high.
+      {
+        USI_TWI_Async_Stretched();
+        break;
+      }
+      PORT_USI |= (1<<PIN_USI_SDA);                 // Release SDA.
+      USI_TWI_Async_Finish();
+      break;
+
+    case ASYNC_CLEAR:
+      if( !(PORT_USI & (1<<PIN_USI_SCL)) )
+      {
+        PORT_USI |= (1<<PIN_USI_SCL);               // Release SCL.
+        break;
+      }
+      if( (PIN_USI & (1<<PIN_USI_SDA)) || --USI_TWI_asyncLeft == 0 )
+        USI_TWI_asyncPhase = ASYNC_STOP;            // SDA free, or gave up on it.
+      PORT_USI &= ~(1<<PIN_USI_SCL);                // Pull SCL LOW.
+      break;
+
+    case ASYNC_IDLE:
+      break;
+
+    default:                                        // Shifting data or (N)ACK.
+      if( USISR & (1<<USIOIF) )                     // Overflow not handled yet: it
+        break;                                      // has lower priority, so wait.
+      if( (PORT_USI & (1<<PIN_USI_SCL)) && !(PIN_USI & (1<<PIN_USI_SCL)) )
+      {
+        USI_TWI_Async_Stretched();                  // Slave is stretching SCL.
+        break;
+      }
+      USI_TWI_asyncStretch = 0;
+      USICR = USICR_ASYNC | (1<<USITC);             // Toggle SCL.
+      break;
+  }
+}
+
+/*---------------------------------------------------------------
+ A byte or (N)ACK bit has been shifted: set up the next one, or
+ finish with a stop condition.
+---------------------------------------------------------------*/
+ISR( USI_OVF_vect )
+{
+  unsigned char data = USIDR;
+
+  USIDR = 0xFF;                                     // Release SDA.
+  DDR_USI |= (1<<PIN_USI_SDA);                      // Enable SDA as output.
+
+  switch( USI_TWI_asyncPhase )
+  {
+    case ASYNC_SEND:
+      DDR_USI &= ~(1<<PIN_USI_SDA);                 // Enable SDA as input.
+      USISR = USISR_1BIT;                           // Clock in (N)ACK.
+      USI_TWI_asyncPhase = ASYNC_ACK_IN;
+      return;
+
+    case ASYNC_ACK_IN:
+      if( data & (1<<TWI_NACK_BIT) )
+      {
+        USI_TWI_asyncError = USI_TWI_asyncAddress ? USI_TWI_NO_ACK_ON_ADDRESS : USI_TWI_NO_ACK_ON_DATA;
+        break;
+      }
+      USI_TWI_asyncAddress = FALSE;
+      if( --USI_TWI_asyncLeft == 0 )
+      {
+        if( !USI_TWI_asyncRestart )
+          break;
+        USI_TWI_asyncRestart = FALSE;               // Register address written, read it back
+        USI_TWI_asyncMsg  = USI_TWI_queue[USI_TWI_queueHead].msg;
+        USI_TWI_asyncLeft = USI_TWI_queue[USI_TWI_queueHead].msgSize;
+        *USI_TWI_asyncMsg |= (1<<TWI_READ_BIT);
+        USI_TWI_asyncRead = TRUE;
+        USISR = USISR_8BIT;                         // Clear flags.
+        USI_TWI_asyncPhase = ASYNC_START;           // Repeated Start.
+        return;
+      }
+      if( USI_TWI_asyncRead )
+      {
+        DDR_USI &= ~(1<<PIN_USI_SDA);               // Enable SDA as input.
+        USI_TWI_asyncPhase = ASYNC_RECEIVE;
+      }
+      else
+      {
+        USIDR = *(USI_TWI_asyncMsg++);              // Setup data.
+        USI_TWI_asyncPhase = ASYNC_SEND;
+      }
+      USISR = USISR_8BIT;
+      return;
+
+    case ASYNC_RECEIVE:
+      *(USI_TWI_asyncMsg++) = data;
+      USIDR = ( USI_TWI_asyncLeft == 1 ) ? 0xFF : 0x00; // NACK the last byte, ACK the rest.
+      USISR = USISR_1BIT;
+      USI_TWI_asyncPhase = ASYNC_ACK_OUT;
+      return;
+
+    case ASYNC_ACK_OUT:
+      if( --USI_TWI_asyncLeft == 0 )
+        break;
+      DDR_USI &= ~(1<<PIN_USI_SDA);                 // Enable SDA as input.
+      USISR = USISR_8BIT;
+      USI_TWI_asyncPhase = ASYNC_RECEIVE;
+      return;
+  }
+
+  USISR = USISR_8BIT;                               // Clear flags.
+  USI_TWI_asyncPhase = ASYNC_STOP;
+}
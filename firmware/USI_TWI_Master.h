@@ -30,19 +30,25 @@
 //********** Defines **********//
 
 // Defines controlling timing limits
+// TWI_STANDARD_MODE (SCL <= 100kHz), TWI_FAST_MODE (SCL <= 400kHz) or
+// TWI_FAST_PLUS_MODE (SCL <= 1MHz). The DS3231 supports up to fast mode.
 #define TWI_FAST_MODE
 
-#define SYS_CLK   4000.0  // [kHz]
-
-#ifdef TWI_FAST_MODE               // TWI FAST mode timing limits. SCL = 100-400kHz
-  #define T2_TWI    ((SYS_CLK *1300) /1000000) +1 // >1,3us
-  #define T4_TWI    ((SYS_CLK * 600) /1000000) +1 // >0,6us
-
+#if defined(TWI_FAST_PLUS_MODE)     // TWI FAST PLUS mode timing limits. SCL = 400-1000kHz
+  #define T2_TWI_NS  500  // >0,5us
+  #define T4_TWI_NS  260  // >0,26us
+#elif defined(TWI_FAST_MODE)       // TWI FAST mode timing limits. SCL = 100-400kHz
+  #define T2_TWI_NS 1300  // >1,3us
+  #define T4_TWI_NS  600  // >0,6us
 #else                              // TWI STANDARD mode timing limits. SCL <= 100kHz
-  #define T2_TWI    ((SYS_CLK *4700) /1000000) +1 // >4,7us
-  #define T4_TWI    ((SYS_CLK *4000) /1000000) +1 // >4,0us
+  #define T2_TWI_NS 4700  // >4,7us
+  #define T4_TWI_NS 4000  // >4,0us
 #endif
 
+// Delays in CPU cycles, rounded up, derived from F_CPU at compile time
+#define T2_TWI    (((F_CPU / 1000) * T2_TWI_NS + 999999) / 1000000)
+#define T4_TWI    (((F_CPU / 1000) * T4_TWI_NS + 999999) / 1000000)
+
 // Defines controling code generating
 //#define PARAM_VERIFICATION
 //#define NOISE_TESTING
@@ -67,6 +73,7 @@
 #define USI_TWI_NO_ACK_ON_ADDRESS   0x06  // The slave did not acknowledge  the address
 #define USI_TWI_MISSING_START_CON   0x07  // Generated Start Condition not detected on bus
 #define USI_TWI_MISSING_STOP_CON    0x08  // Generated Stop Condition not detected on bus
+#define USI_TWI_BUS_TIMEOUT         0x09  // SCL held low too long, bus cleared
 
 // Device dependant defines
 
@@ -122,8 +129,32 @@
 #define TRUE  1
 #define FALSE 0
 
+// Asynchronous transactions. SCL edges are clocked from Timer1 compare B,
+// which has to be free-running at F_CPU/8 (see timer_init() in main.c),
+// and the USI overflow interrupt steps through bytes and (N)ACKs.
+#define USI_TWI_QUEUE_SIZE   4      // Pending transactions, including the active one
+#define USI_TWI_ASYNC_SCL    25000  // [Hz], each edge costs an interrupt
+#define USI_TWI_HALF_PERIOD  ((F_CPU / 8) / (2 * USI_TWI_ASYNC_SCL)) // [Timer1 ticks]
+
+// Longest SCL may be held low before the transaction is abandoned. The bus
+// is then cleared with up to nine SCL pulses, until the slave releases SDA,
+// and a Stop Condition.
+#define USI_TWI_TIMEOUT_US     5000   // [us]
+#define USI_TWI_TIMEOUT_EDGES  (USI_TWI_TIMEOUT_US * 2L * USI_TWI_ASYNC_SCL / 1000000)
+#if USI_TWI_TIMEOUT_EDGES > 255
+  #error "USI_TWI_TIMEOUT_US is too long to count in SCL edges"
+#endif
+
+// Called from interrupt context when a queued transaction has finished,
+// with 0 on success or one of the error codes above.
+typedef void (*USI_TWI_Callback)( unsigned char status );
+
 //********** Prototypes **********//
 
 void              USI_TWI_Master_Initialise( void );
  unsigned char USI_TWI_Start_Transceiver_With_Data( unsigned char * , unsigned char );
 unsigned char USI_TWI_Get_State_Info( void );
+unsigned char USI_TWI_Start_Random_Read( unsigned char * , unsigned char );
+unsigned char USI_TWI_Queue_Transceiver_With_Data( unsigned char * , unsigned char , USI_TWI_Callback );
+unsigned char USI_TWI_Queue_Random_Read( unsigned char * , unsigned char , USI_TWI_Callback );
+unsigned char USI_TWI_Busy( void );
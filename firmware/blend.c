@@ -0,0 +1,126 @@
+/* Name: blend.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include "blend.h"
+
+/* Each kernel blends the GRB triple at src into the one at dst, without
+ * branching on the data: a carry or borrow becomes a 0x00/0xFF mask with sbc.
+ * Cycle counts are per channel. */
+
+/* dst = min(dst + src, 255): 5c + loop */
+void blend_add(uint8_t *dst, const uint8_t *src)
+{
+  uint8_t n = 3;
+  uint8_t d, s;
+
+  asm volatile(
+      "1:"                    "\n\t"
+      "ld %[d], %a[dst]"      "\n\t"
+      "ld %[s], %a[src]+"     "\n\t"
+      "add %[d], %[s]"        "\n\t" /* C on overflow */
+      "sbc %[s], %[s]"        "\n\t" /* 0xFF on overflow, else 0 */
+      "or %[d], %[s]"         "\n\t" /* saturate */
+      "st %a[dst]+, %[d]"     "\n\t"
+      "dec %[n]"              "\n\t"
+      "brne 1b"               "\n\t"
+      : [dst] "+e" (dst)
+      , [src] "+e" (src)
+      , [n]   "+r" (n)
+      , [d]   "=&r" (d)
+      , [s]   "=&r" (s)
+      :
+      : "memory"
+      );
+}
+
+/* dst = max(dst, src): 7c + loop */
+void blend_max(uint8_t *dst, const uint8_t *src)
+{
+  uint8_t n = 3;
+  uint8_t d, s, t;
+
+  asm volatile(
+      "1:"                    "\n\t"
+      "ld %[d], %a[dst]"      "\n\t"
+      "ld %[s], %a[src]+"     "\n\t"
+      "mov %[t], %[d]"        "\n\t"
+      "sub %[t], %[s]"        "\n\t" /* t = d - s, C if d < s */
+      "sbc %[s], %[s]"        "\n\t" /* 0xFF if d < s, else 0 */
+      "and %[t], %[s]"        "\n\t"
+      "sub %[d], %[t]"        "\n\t" /* d - (d - s) = s if d < s */
+      "st %a[dst]+, %[d]"     "\n\t"
+      "dec %[n]"              "\n\t"
+      "brne 1b"               "\n\t"
+      : [dst] "+e" (dst)
+      , [src] "+e" (src)
+      , [n]   "+r" (n)
+      , [d]   "=&r" (d)
+      , [s]   "=&r" (s)
+      , [t]   "=&r" (t)
+      :
+      : "memory"
+      );
+}
+
+/* dst += (src - dst) * alpha / 256, with the 8x8 multiply done by shift and
+ * add (Atmel AVR200 mpy8u) on |src - dst|: about 50c + loop */
+void blend_over(uint8_t *dst, const uint8_t *src, uint8_t alpha)
+{
+  uint8_t n = 3;
+  uint8_t d, s, sign, hi, lo, bits;
+
+  asm volatile(
+      "1:"                    "\n\t"
+      "ld %[d], %a[dst]"      "\n\t"
+      "ld %[s], %a[src]+"     "\n\t"
+      "sub %[s], %[d]"        "\n\t" /* s - d, C if negative */
+      "sbc %[sign], %[sign]"  "\n\t" /* 0xFF if negative, else 0 */
+      "eor %[s], %[sign]"     "\n\t"
+      "sub %[s], %[sign]"     "\n\t" /* |s - d| */
+      "clr %[hi]"             "\n\t"
+      "mov %[lo], %[alpha]"   "\n\t"
+      "ldi %[bits], 8"        "\n\t"
+      "lsr %[lo]"             "\n\t"
+      "2:"                    "\n\t" /* hi:lo = |s - d| * alpha */
+      "brcc 3f"               "\n\t"
+      "add %[hi], %[s]"       "\n\t"
+      "3:"                    "\n\t"
+      "ror %[hi]"             "\n\t"
+      "ror %[lo]"             "\n\t"
+      "dec %[bits]"           "\n\t"
+      "brne 2b"               "\n\t"
+      "eor %[hi], %[sign]"    "\n\t"
+      "sub %[hi], %[sign]"    "\n\t" /* back to the sign of s - d */
+      "add %[d], %[hi]"       "\n\t"
+      "st %a[dst]+, %[d]"     "\n\t"
+      "dec %[n]"              "\n\t"
+      "brne 1b"               "\n\t"
+      : [dst]   "+e" (dst)
+      , [src]   "+e" (src)
+      , [n]     "+r" (n)
+      , [d]     "=&r" (d)
+      , [s]     "=&r" (s)
+      , [sign]  "=&r" (sign)
+      , [hi]    "=&r" (hi)
+      , [lo]    "=&r" (lo)
+      , [bits]  "=&d" (bits)
+      : [alpha] "r" (alpha)
+      : "memory"
+      );
+}
+
+void blend(uint8_t *dst, const uint8_t *src, uint8_t mode)
+{
+  if (mode == BLEND_ADD) {
+    blend_add(dst, src);
+  }
+  else if (mode == BLEND_MAX) {
+    blend_max(dst, src);
+  }
+  else {
+    blend_over(dst, src, mode);
+  }
+}
@@ -0,0 +1,24 @@
+/* Name: blend.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdint.h>
+
+/* Ways to draw a GRB color over a pixel, in a byte: saturating add, the
+ * larger of each channel, or alpha over with an alpha from 2 to 255 (255 is
+ * within a level of opaque). */
+#define BLEND_ADD 0
+#define BLEND_MAX 1
+#define BLEND_OVER(alpha) ((alpha) < 2 ? 2 : (alpha))
+
+void blend_add(uint8_t *dst, const uint8_t *src);
+void blend_max(uint8_t *dst, const uint8_t *src);
+void blend_over(uint8_t *dst, const uint8_t *src, uint8_t alpha);
+void blend(uint8_t *dst, const uint8_t *src, uint8_t mode);
+
+#endif
@@ -0,0 +1,107 @@
+/* Name: buttons.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "buttons.h"
+
+/* Debounced state, a bit per button: 1 while pressed */
+static volatile uint8_t pressed;
+/* Buttons whose pin changes are being ignored */
+static volatile uint8_t settling;
+static uint8_t settle_ticks[BUTTONS];
+/* Ticks until a held button's next repeat, and the interval after that */
+static uint8_t repeat_ticks[BUTTONS];
+static uint8_t repeat_interval[BUTTONS];
+
+static volatile uint8_t queue[BUTTON_QUEUE_SIZE];
+static volatile uint8_t queue_head;
+static volatile uint8_t queue_tail;
+
+/* Called with interrupts off */
+static void queue_event(uint8_t event)
+{
+  uint8_t next = (queue_head + 1) % BUTTON_QUEUE_SIZE;
+  if (next != queue_tail) {
+    queue[queue_head] = event;
+    queue_head = next;
+  }
+}
+
+/* Take the changes on pins that aren't settling. Called with interrupts off. */
+static void sample(void)
+{
+  uint8_t changed = (~BUTTON_PINS & BUTTON_MASK) ^ pressed;
+  uint8_t i, bit;
+
+  changed &= ~settling;
+  for (i = 0, bit = 1; i < BUTTONS; i++, bit <<= 1) {
+    if (!(changed & bit)) {
+      continue;
+    }
+    pressed ^= bit;
+    settling |= bit;
+    settle_ticks[i] = BUTTON_DEBOUNCE;
+    if (pressed & bit) {
+      repeat_ticks[i] = BUTTON_REPEAT;
+      repeat_interval[i] = BUTTON_REPEAT_MAX;
+      queue_event(BUTTON_PRESS | i);
+    }
+    else {
+      queue_event(BUTTON_RELEASE | i);
+    }
+  }
+}
+
+ISR (PCINT1_vect)
+{
+  sample();
+}
+
+void buttons_init(void)
+{
+  BUTTON_PORT |= BUTTON_MASK; /* inputs with pullups */
+  PCMSK1 |= BUTTON_MASK;
+  GIMSK |= (1 << PCIE1);
+}
+
+void buttons_update(void)
+{
+  uint8_t i, bit;
+
+  cli();
+  for (i = 0, bit = 1; i < BUTTONS; i++, bit <<= 1) {
+    if ((settling & bit) && --settle_ticks[i] == 0) {
+      settling &= ~bit;
+    }
+    if ((pressed & bit) && --repeat_ticks[i] == 0) {
+      queue_event(BUTTON_REPEATS | i);
+      /* each repeat comes about a quarter sooner than the last */
+      repeat_interval[i] -= (repeat_interval[i] + 3) / 4;
+      if (repeat_interval[i] < BUTTON_REPEAT_MIN) {
+        repeat_interval[i] = BUTTON_REPEAT_MIN;
+      }
+      repeat_ticks[i] = repeat_interval[i];
+    }
+  }
+  /* catch anything that changed while its button was settling */
+  sample();
+  sei();
+}
+
+uint8_t button_event(void)
+{
+  uint8_t event = BUTTON_NONE;
+
+  cli();
+  if (queue_tail != queue_head) {
+    event = queue[queue_tail];
+    queue_tail = (queue_tail + 1) % BUTTON_QUEUE_SIZE;
+  }
+  sei();
+  return event;
+}
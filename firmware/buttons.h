@@ -0,0 +1,47 @@
+/* Name: buttons.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+
+/* Buttons on PB0-PB2, pulled up and closing to ground. A pin change
+ * interrupt registers each press or release as it happens, then ignores
+ * that button for BUTTON_DEBOUNCE ticks while its contacts settle. Held
+ * buttons repeat, faster the longer they're held. */
+#define BUTTON_PORT PORTB
+#define BUTTON_PINS PINB
+#define BUTTON_MASK ((1 << PORTB0) | (1 << PORTB1) | (1 << PORTB2))
+#define BUTTONS 3
+
+/* Call buttons_update() every BUTTON_TICK_MS; the times below are in ticks */
+#define BUTTON_TICK_MS    10
+#define BUTTON_DEBOUNCE   3  /* ignore bounces for 30ms */
+#define BUTTON_REPEAT     50 /* first repeat after half a second */
+#define BUTTON_REPEAT_MAX 20 /* then five a second, */
+#define BUTTON_REPEAT_MIN 2  /* speeding up to fifty */
+
+/* Events, with the button number in the low bits */
+#define BUTTON_PRESS   0x00
+#define BUTTON_REPEATS 0x40
+#define BUTTON_RELEASE 0x80
+#define BUTTON_EVENT   0xC0
+#define BUTTON_NUMBER  0x3F
+#define BUTTON_NONE    0xFF
+
+/* Events queued and not yet taken, older ones are kept when it fills */
+#define BUTTON_QUEUE_SIZE 8
+
+void buttons_init(void);
+
+/* Advance debouncing and auto-repeat by a tick */
+void buttons_update(void);
+
+/* The next event from the queue, or BUTTON_NONE */
+uint8_t button_event(void);
+
+#endif
@@ -0,0 +1,109 @@
+/* Name: easing.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include <avr/pgmspace.h>
+#include "easing.h"
+
+/* The ATtiny has no hardware multiply or divide, so the curves are lookup
+ * tables indexed with the top bits of the phase, and the low bits interpolate
+ * between neighboring entries using shifts only. */
+
+/* First half of the ease in-out curve, 129 entries covering phase 0..512,
+ * ending at EASE_ONE/2. The second half is the same curve mirrored. */
+#ifdef EASE_SINE
+/* y = (1 - cos(pi * x)) / 2 */
+static const uint16_t ease_table[129] PROGMEM = {
+      0,     1,     5,    11,    20,    31,    44,    60,
+     79,   100,   123,   149,   177,   208,   241,   277,
+    315,   355,   398,   443,   491,   541,   593,   648,
+    705,   765,   827,   891,   958,  1027,  1098,  1171,
+   1247,  1325,  1406,  1488,  1573,  1660,  1749,  1841,
+   1935,  2030,  2128,  2229,  2331,  2435,  2542,  2651,
+   2761,  2874,  2989,  3105,  3224,  3345,  3468,  3592,
+   3719,  3847,  3978,  4110,  4244,  4380,  4518,  4657,
+   4799,  4942,  5087,  5233,  5381,  5531,  5682,  5835,
+   5990,  6146,  6304,  6463,  6624,  6786,  6950,  7115,
+   7282,  7449,  7619,  7789,  7961,  8134,  8308,  8484,
+   8661,  8839,  9018,  9198,  9379,  9561,  9745,  9929,
+  10114, 10300, 10487, 10676, 10864, 11054, 11245, 11436,
+  11628, 11821, 12014, 12208, 12403, 12598, 12794, 12991,
+  13188, 13385, 13583, 13781, 13980, 14179, 14378, 14578,
+  14778, 14978, 15179, 15379, 15580, 15781, 15982, 16183,
+  16384,
+};
+#else
+/* y = 2 * x^2, same curve the hands used before the tables */
+static const uint16_t ease_table[129] PROGMEM = {
+      0,     1,     4,     9,    16,    25,    36,    49,
+     64,    81,   100,   121,   144,   169,   196,   225,
+    256,   289,   324,   361,   400,   441,   484,   529,
+    576,   625,   676,   729,   784,   841,   900,   961,
+   1024,  1089,  1156,  1225,  1296,  1369,  1444,  1521,
+   1600,  1681,  1764,  1849,  1936,  2025,  2116,  2209,
+   2304,  2401,  2500,  2601,  2704,  2809,  2916,  3025,
+   3136,  3249,  3364,  3481,  3600,  3721,  3844,  3969,
+   4096,  4225,  4356,  4489,  4624,  4761,  4900,  5041,
+   5184,  5329,  5476,  5625,  5776,  5929,  6084,  6241,
+   6400,  6561,  6724,  6889,  7056,  7225,  7396,  7569,
+   7744,  7921,  8100,  8281,  8464,  8649,  8836,  9025,
+   9216,  9409,  9604,  9801, 10000, 10201, 10404, 10609,
+  10816, 11025, 11236, 11449, 11664, 11881, 12100, 12321,
+  12544, 12769, 12996, 13225, 13456, 13689, 13924, 14161,
+  14400, 14641, 14884, 15129, 15376, 15625, 15876, 16129,
+  16384,
+};
+#endif
+
+/* n/60ths of EASE_ONE, for n = 0..59 */
+static const uint16_t sixtieths[60] PROGMEM = {
+      0,   546,  1092,  1638,  2185,  2731,  3277,  3823,
+   4369,  4915,  5461,  6007,  6554,  7100,  7646,  8192,
+   8738,  9284,  9830, 10377, 10923, 11469, 12015, 12561,
+  13107, 13653, 14199, 14746, 15292, 15838, 16384, 16930,
+  17476, 18022, 18569, 19115, 19661, 20207, 20753, 21299,
+  21845, 22391, 22938, 23484, 24030, 24576, 25122, 25668,
+  26214, 26761, 27307, 27853, 28399, 28945, 29491, 30037,
+  30583, 31130, 31676, 32222,
+};
+
+/* Look up the first half of the curve, x is 0..PHASE_ONE/2 */
+static uint16_t half_curve(uint16_t x)
+{
+  uint8_t i = x >> 2;
+  uint16_t y = pgm_read_word(&ease_table[i]);
+  uint16_t delta;
+
+  if (x & 3) {
+    delta = pgm_read_word(&ease_table[i + 1]) - y;
+    if (x & 2) { y += delta >> 1; }
+    if (x & 1) { y += delta >> 2; }
+  }
+  return y;
+}
+
+uint16_t ease_in_out(uint16_t phase)
+{
+  if (phase < PHASE_ONE / 2) {
+    return half_curve(phase);
+  }
+  return EASE_ONE - half_curve(PHASE_ONE - phase);
+}
+
+/* One second is 546.13 sixtieths-of-a-minute units, and phase is in 1024ths
+ * of a second: phase * 0.5333 = phase/2 + phase/32 + phase/512 */
+uint16_t minute_sweep(uint8_t second, uint16_t phase)
+{
+  return pgm_read_word(&sixtieths[second])
+    + (phase >> 1) + (phase >> 5) + (phase >> 9);
+}
+
+/* A second of the hour is 1/60th of that second's sixtieths entry, and
+ * x/60 ~= x/64 + x/1024 */
+uint16_t hour_sweep(uint8_t minute, uint8_t second)
+{
+  uint16_t s = pgm_read_word(&sixtieths[second]);
+  return pgm_read_word(&sixtieths[minute]) + (s >> 6) + (s >> 10);
+}
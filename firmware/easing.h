@@ -0,0 +1,29 @@
+/* Name: easing.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef EASING_H
+#define EASING_H
+
+#include <stdint.h>
+
+/* Sub-second phase: 1024 steps per second, so wrapping and splitting into
+ * table index and interpolation fraction are shifts and masks */
+#define PHASE_BITS 10
+#define PHASE_ONE  (1 << PHASE_BITS)
+
+/* Full-scale easing and sweep output, 1.0 in 1.15 fixed point */
+#define EASE_ONE 32768
+
+/* Ease in-out across one period: phase 0..PHASE_ONE-1 -> 0..EASE_ONE */
+uint16_t ease_in_out(uint16_t phase);
+
+/* Linear sweep of the minute hand across a minute: 0..EASE_ONE-1 */
+uint16_t minute_sweep(uint8_t second, uint16_t phase);
+
+/* Linear sweep of the hour hand across an hour: 0..EASE_ONE-1 */
+uint16_t hour_sweep(uint8_t minute, uint8_t second);
+
+#endif
@@ -0,0 +1,60 @@
+# Name: layout.awk
+# Author: Nathan Witmer
+# Copyright: 2015 Nathan Witmer
+# License: MIT (see LICENSE)
+#
+# Writes layout.h: where each logical pixel sits in the pixel buffer, as the
+# physical pixel times scale (3 for GRB bytes, 1 for palette indexes). Logical
+# pixel 0 is the top of the clock and they count clockwise. Covers two turns
+# of the ring so callers can run an index past the top without wrapping it.
+#
+# Also writes the clock face for each physical pixel, for renderers that
+# draw it on the way out: 0 for none, 1 for a five minute mark, 2 for a
+# quarter hour and 3 for the top.
+#
+#   awk -v pixels=60 -v offset=37 -v reverse=0 -v scale=3 -v map="" -f layout.awk
+#
+# map, when given, lists the physical pixel for each logical one and replaces
+# offset and reverse.
+
+BEGIN {
+  if (scale == "") {
+    scale = 3
+  }
+  if (map != "") {
+    if (split(map, physical, /[ ,]+/) != pixels) {
+      print "layout.awk: PIXEL_MAP needs " pixels " entries" > "/dev/stderr"
+      exit 1
+    }
+  }
+
+  size = pixels * 2
+  if (size > 256) {
+    size = 256
+  }
+
+  for (i = 0; i < pixels; i++) {
+    if (map != "") {
+      p = physical[i + 1]
+    }
+    else {
+      p = reverse ? (pixels - i) % pixels : i
+      p = (p + offset) % pixels
+    }
+    layout[i] = p
+    face[p] = i == 0 ? 3 : i % 15 == 0 ? 2 : i % 5 == 0 ? 1 : 0
+  }
+
+  print "/* Generated by layout.awk from the Makefile, do not edit */"
+  print "#define PIXEL_LAYOUT_SIZE " size
+  printf "#define PIXEL_LAYOUT"
+  for (i = 0; i < size; i++) {
+    printf "%s%s%d", (i ? "," : ""), (i % 12 ? " " : " \\\n  "), layout[i % pixels] * scale
+  }
+  print ""
+  printf "#define PIXEL_FACE"
+  for (i = 0; i < pixels; i++) {
+    printf "%s%s%d", (i ? "," : ""), (i % 20 ? " " : " \\\n  "), face[i] + 0
+  }
+  print ""
+}
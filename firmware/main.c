@@ -7,32 +7,246 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdlib.h>
+#include <string.h>
 #include <avr/pgmspace.h>
 #include <util/delay.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
 #include "softuart.h"
 #include "USI_TWI_Master.h"
+#include "easing.h"
+#include "stream.h"
+#include "layout.h"
+#include "blend.h"
+#include "sched.h"
+#include "buttons.h"
+#include "profile.h"
 
-#define PIXELS 60
-/* #define PIXEL_OFFSET 37 */
+/* #define PIXELS 60 */
+/* The hands, pendulum and face marks are drawn on a 60 pixel dial */
+#if PIXELS != 60
+#error "the clock is drawn on a ring of 60 pixels"
+#endif
+/* Bits stored per pixel: 24 for GRB, or 8 or 4 for an index into a palette
+ * of the frame's colors, which shrinks the frame from 180 bytes to 156 or 78.
+ * 0 keeps no framebuffer: a frame is a short list of lit pixels, merged with
+ * the clock face as the pixels are written out. */
+#ifndef PIXEL_BITS
+#define PIXEL_BITS 24
+#endif
+/* Bytes per pixel: 3 for GRB (WS2812B), 4 for GRBW (SK6812 RGBW), whose
+ * white channel is left off */
+#ifndef PIXEL_BYTES
+#define PIXEL_BYTES 3
+#endif
+#if PIXEL_BYTES != 3 && PIXEL_BYTES != 4
+#error "PIXEL_BYTES must be 3 or 4"
+#endif
+#if PIXEL_BITS == 24
+#define PIXEL_RAM (PIXELS * PIXEL_BYTES)
+#elif PIXEL_BITS == 0
+/* Lit pixels per frame: the hands and pendulum take 8 */
+#ifndef BEAM_PIXELS
+#define BEAM_PIXELS 12
+#endif
+#define PIXEL_RAM (BEAM_PIXELS * 4)
+#elif PIXEL_BITS == 8 || PIXEL_BITS == 4
+#if PIXEL_BITS == 4
+#undef PALETTE_SIZE
+#define PALETTE_SIZE 16
+#elif !defined(PALETTE_SIZE)
+#define PALETTE_SIZE 32
+#endif
+#define PIXEL_RAM ((PIXELS * PIXEL_BITS + 7) / 8 + PALETTE_SIZE * PIXEL_BYTES)
+#else
+#error "PIXEL_BITS must be 24, 8, 4 or 0"
+#endif
+/* Frame storage, out of 512 bytes of SRAM: the rest goes to the serial
+ * buffers, the TWI queue, the tasks and the stack */
+#define PIXEL_RAM_MAX 256
+#if PIXEL_RAM > PIXEL_RAM_MAX
+#error "the frame doesn't fit in RAM, try fewer PIXEL_BITS"
+#endif
 #define PIXEL_PORT PORTA
 #define PIXEL_DDR  DDRA
 #define PIXEL_BIT  PORTA5
 
-#define BTN_PORT PORTB
-#define BTN_PINS PINB
-#define BTN0 PORTB0
-#define BTN1 PORTB1
-#define BTN2 PORTB2
+/* WS2812B/SK6812 bit timing, padded out with nops for F_CPU. The bit loop
+ * takes 3 cycles to a 0's falling edge, 7 to a 1's, and 11 for a 1's full
+ * period; the pads stretch each to its target. */
+#define PIXEL_T0H_NS 350
+#define PIXEL_T1H_NS 750
+#define PIXEL_TBIT_NS 1250
+#define NS_CYCLES(ns) ((F_CPU / 1000 * (ns) + 500000) / 1000000)
+#define CYCLES_NS(c) ((c) * 1000000 / (F_CPU / 1000))
+#define PAD(cycles, used) ((cycles) > (used) ? (cycles) - (used) : 0)
+#define PIXEL_PAD_T0H PAD(NS_CYCLES(PIXEL_T0H_NS), 3)
+#define PIXEL_PAD_T1H PAD(NS_CYCLES(PIXEL_T1H_NS), 7 + PIXEL_PAD_T0H)
+#define PIXEL_PAD_TBIT \
+  PAD(NS_CYCLES(PIXEL_TBIT_NS), 11 + PIXEL_PAD_T0H + PIXEL_PAD_T1H)
+/* Resulting timing, checked against the parts' data sheets: 0 is read as
+ * high for under ~550ns, 1 as high for over ~625ns */
+#define PIXEL_T0H (CYCLES_NS(3 + PIXEL_PAD_T0H))
+#define PIXEL_T1H (CYCLES_NS(7 + PIXEL_PAD_T0H + PIXEL_PAD_T1H))
+#define PIXEL_TBIT \
+  (CYCLES_NS(11 + PIXEL_PAD_T0H + PIXEL_PAD_T1H + PIXEL_PAD_TBIT))
+#if PIXEL_T0H < 200 || PIXEL_T0H > 500
+#error "F_CPU gives a WS2812 0 bit out of spec"
+#endif
+#if PIXEL_T1H < 625 || PIXEL_T1H > 1500
+#error "F_CPU gives a WS2812 1 bit out of spec"
+#endif
+#if PIXEL_TBIT < 1150 || PIXEL_TBIT > 2500
+#error "F_CPU gives a WS2812 bit period out of spec"
+#endif
+/* Cycles send_bytes() keeps interrupts off: each byte takes 13 for its
+ * lookup and the loop, and eight bits at up to 12 plus pads (a 0 skips the
+ * cbi, one more than a 1); then a few to save and restore SREG. A softuart
+ * tick coming twice in one window loses one. */
+#define PIXEL_BIT_CYCLES (12 + PIXEL_PAD_T0H + PIXEL_PAD_T1H + PIXEL_PAD_TBIT)
+#define PIXEL_WINDOW_CYCLES(bytes) (8 + (bytes) * (13 + 8 * PIXEL_BIT_CYCLES))
+#define SOFTUART_TICK_CYCLES (SOFTUART_TIMERTOP * SOFTUART_PRESCALE)
+#if PIXEL_WINDOW_CYCLES(1) >= SOFTUART_TICK_CYCLES
+#error "a pixel byte takes longer than a softuart tick at this F_CPU and baud"
+#endif
+/* Pixels written per interrupts-off window, must divide PIXELS evenly */
+#define PIXEL_GROUP 1
+#if PIXELS % PIXEL_GROUP
+#error "PIXEL_GROUP must divide PIXELS evenly"
+#endif
+/* Bytes per interrupts-off window: the whole group if it fits in a softuart
+ * tick, which saves the call overhead, otherwise a byte at a time */
+#if PIXEL_WINDOW_CYCLES(PIXEL_GROUP * PIXEL_BYTES) < SOFTUART_TICK_CYCLES
+#define GROUP_BYTES (PIXEL_GROUP * PIXEL_BYTES)
+#else
+#define GROUP_BYTES 1
+#endif
+#if PIXEL_WINDOW_CYCLES(GROUP_BYTES) >= SOFTUART_TICK_CYCLES
+#error "pixel writes keep interrupts off for longer than a softuart tick"
+#endif
 
-#define MILLIS_OVERFLOW ((F_CPU / 1000) / 8)
+/* Buttons: mode (held for minutes), down and up */
+#define BTN_MODE 0
+#define BTN_DOWN 1
+#define BTN_UP   2
+
+/* ADC clock within the 50-200kHz the datasheet asks for at 10 bits */
+#if F_CPU / 64 <= 200000
+#define ADC_PRESCALE ((1 << ADPS2) | (1 << ADPS1))
+#else
+#define ADC_PRESCALE ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0))
+#endif
+/* Conversions summed per light reading: 16 10-bit samples fill 14 bits */
+#define ADC_SAMPLES 16
+/* Light level thresholds stick until the reading moves this far past them */
+#define LIGHT_HYSTERESIS 6
+
+/* Timer1 free-runs at F_CPU/8, 1us per tick at 8MHz */
+#define TICKS_PER_SECOND (F_CPU / 8)
+/* The scheduler ticks every millisecond, on Timer1's compare A */
+#define SCHED_HZ 1000
+#define SCHED_TICKS (TICKS_PER_SECOND / SCHED_HZ)
+/* Timer1 ticks in a number of microseconds, for task budgets */
+#define US_TICKS(us) ((uint32_t)(us) * (TICKS_PER_SECOND / 1000) / 1000)
+/* Frames drawn per second, at most: the main loop sleeps in between */
+#ifndef FRAME_RATE
+#define FRAME_RATE 50
+#endif
+/* Shift that keeps the longest second second_edge() accepts, 3/2 of
+ * TICKS_PER_SECOND, within 16 bits */
+#if TICKS_PER_SECOND * 3 / 2 >> 5 > 0xFFFF
+#define PHASE_SHIFT 6
+#else
+#define PHASE_SHIFT 5
+#endif
 
 #define RTC_ADDR 0xD0
+#ifdef RTC_DS1307
+#define RTC_CONTROL 0x07
+#define RTC_SQW_1HZ 0x10 /* SQWE, RS1:0 = 00 */
+#else
+#define RTC_CONTROL 0x0E
+#define RTC_SQW_1HZ 0x00 /* INTCN off, RS2:1 = 00 */
+#endif
+
+/* With RTC_SQW, the RTC's 1Hz INT/SQW output wired to PA3 (not routed on the
+ * board) marks each second and the RTC is only read every RTC_VERIFY_SECONDS.
+ * Without it, the RTC is polled near the end of each local second. */
+#define SQW_PORT PORTA
+#define SQW_PINS PINA
+#define SQW_BIT  PORTA3
+#define RTC_VERIFY_SECONDS 60
+#define RTC_POLL_WINDOW (PHASE_ONE / 8)
+/* Without an answer from the RTC this long after the local second ends,
+ * the next one starts anyway */
+#define RTC_LATE (TICKS_PER_SECOND / 4)
+/* Adjusted time is written to the RTC once the buttons are idle this long,
+ * and failed writes are tried again after as long */
+#define RTC_WRITE_DELAY (TICKS_PER_SECOND / 2)
+/* The RC oscillator is trimmed until TRIM_SECONDS of RTC seconds take as
+ * many Timer1 ticks, give or take 0.4%, or half an OSCCAL step once one has
+ * been measured, as no setting gets closer than that. The long span makes the
+ * jitter in when each edge is seen small next to the error being corrected. */
+#define TRIM_SECONDS 64
+#define TRIM_TICKS (TRIM_SECONDS * TICKS_PER_SECOND)
+#define TRIM_TOLERANCE (TRIM_TICKS / 256)
 
-#define SCALE(val) ((val) * output_level / 128)
-#define PENDULUM_PERIOD 4000
-#define HALF_PERIOD 2000
+/* Serial time set command: 'T' then yymmddwHHMMSS, optionally followed by
+ * three digits of milliseconds past that second, as `make serial` sends */
+#define COMMAND_TIME 'T'
+#define TIME_DIGITS 13
+#define TIME_DIGITS_MS 16
+/* Serial error report command */
+#define COMMAND_ERRORS 'E'
+/* Serial profile report command, with PROFILE */
+#define COMMAND_PROFILE 'P'
+/* Ticks to receive one byte: start, 8 data and stop bits */
+#define BYTE_TICKS (10 * TICKS_PER_SECOND / SOFTUART_BAUD_RATE)
 
-static uint8_t grb[PIXELS*3];
+/* Colors are drawn at full range, 0-255, and gamma corrected and scaled to
+ * the output level as they're written out. Face marks come out at the old
+ * output_level / 16 and / 32; dim ones get FACE_DIM, which comes out at 1
+ * from the lowest level up. */
+#define FACE_MAJOR 75
+#define FACE_MINOR 56
+#define FACE_DIM   98
+
+/* How each element is drawn over the ones before it (see blend.h). The
+ * hands add, so a hand's two pixels sum to one, and the pendulum takes the
+ * brighter of itself and what's under it rather than clipping. */
+#define HAND_BLEND     BLEND_ADD
+#define PENDULUM_BLEND BLEND_MAX
+
+#if PIXEL_BITS == 24
+static uint8_t grb[PIXELS*PIXEL_BYTES];
+/* The clock face stays drawn in grb between frames. Pixels drawn over it are
+ * tracked, with the face's (gray) level to restore them to. */
+#define DIRTY_PIXELS 12
+static struct {
+  uint8_t offset;
+  uint8_t level;
+} dirty[DIRTY_PIXELS];
+static uint8_t dirty_count;
+static uint8_t face_drawn;  /* grb holds the face at face_drawn_level */
+static uint8_t face_drawn_level;
+#elif PIXEL_BITS == 0
+/* Lit pixels in the frame, sorted by physical pixel */
+static struct {
+  uint8_t pixel;
+  uint8_t grb[3];
+} beam[BEAM_PIXELS];
+static uint8_t beam_count;
+/* Level of each kind of clock face mark, see layout.awk */
+#define FACE_FIVE    1
+#define FACE_QUARTER 2
+#define FACE_TOP     3
+static uint8_t face[4];
+#else
+/* Colors in the current frame as GRB, with black in entry 0. Pixels hold an index into it. */
+static uint8_t palette[PALETTE_SIZE*PIXEL_BYTES];
+static uint8_t palette_count;
+static uint8_t pixel_index[(PIXELS * PIXEL_BITS + 7) / 8];
+#endif
 static uint8_t hour;
 static uint8_t minute;
 static uint8_t second;
@@ -40,153 +254,748 @@ static uint8_t prev_second;
 
 typedef enum {UP, DOWN} direction;
 static enum {CLOCK, ALT, SERIAL} mode = CLOCK;
+static uint32_t stream_ticks; /* when the last streamed frame was shown */
+
+/* Everything a frame of the clock depends on, to skip redrawing and sending
+ * one that would come out the same as the last */
+struct frame {
+  uint8_t second, minute, hour_pos;
+  uint8_t second_level, minute_level, hour_level;
+  uint16_t pendulum;
+  uint8_t output_level;
+  uint8_t draw_pendulum;
+};
+static struct frame shown;
+static uint8_t shown_valid;
 
-static uint8_t btn0_pressed;
-static uint8_t btn1_pressed;
-static uint8_t btn2_pressed;
+/* Time set command being received */
+static uint8_t command_digits[TIME_DIGITS_MS];
+static uint8_t command_len = 0xFF; /* digits so far, 0xFF outside a command */
+static uint32_t command_ticks;     /* when the last digit arrived */
+static uint8_t set_pending;        /* write the time at the next local second */
 
-/* How many milliseconds since last second changed */
-/* Accessing this directly could be buggy, but not worried for now */
-volatile uint16_t millisecond;
-static uint16_t prev_max_ms = 1000; /* Previous max ms value */
+/* Scheduler ticks so far, and whether one has come since tasks last ran */
+static volatile uint16_t sched_ticks;
+static volatile uint8_t sched_due;
+
+/* Upper 16 bits of the Timer1 tick count */
+static volatile uint16_t tick_overflows;
+/* Tick count at the last RTC second edge */
+static uint32_t second_start;
+/* Measured ticks per RTC second, and its reciprocal: 2^31 / second_ticks */
+static uint32_t second_ticks = TICKS_PER_SECOND;
+static uint16_t second_scale = (1UL << 31) / TICKS_PER_SECOND;
+/* RTC second edges since trim_start, 0 to start over at the next one */
+static uint8_t trim_edges;
+static uint32_t trim_start;
+/* The last span's error in ticks, the OSCCAL it was measured at, and the
+ * ticks one step between neighbouring settings moved it by */
+static int32_t trim_error;
+static uint8_t trim_cal;
+static uint32_t trim_step;
+/* OSCCAL once trimmed, with its complement in the high byte */
+static uint16_t EEMEM saved_trim;
+/* Trim waiting to be saved, and its bytes left to write */
+static uint16_t trim_saving;
+static uint8_t trim_save_bytes;
+
+/* RTC transfers run in the background, and their buffers have to stay put
+ * until the transfer's callback runs */
+static uint8_t rtc_time[4];    /* address, seconds (register pointer), minutes, hours */
+static uint8_t rtc_set[9];     /* address, register pointer, time, then the date */
+static uint8_t rtc_date[4];    /* BCD day of week, date, month, year */
+static uint8_t date_pending;   /* write rtc_date with the next set_time() */
+static volatile enum {TIME_IDLE, TIME_PENDING, TIME_READY} time_state;
+static volatile uint8_t read_status;
+static volatile uint8_t write_status;
+static volatile uint8_t write_pending;
+/* The local time has changes the RTC hasn't seen yet, as of dirty_ticks */
+static volatile uint8_t time_dirty;
+static volatile uint32_t dirty_ticks;
+static uint8_t discard_time;
+/* Tick count when the last read finished */
+static volatile uint32_t time_ticks;
+/* RTC transfer failures since reset, reported by the error command */
+static struct {
+  uint16_t queue;    /* the TWI queue was full */
+  uint16_t nack;     /* the RTC didn't answer */
+  uint16_t timeout;  /* SCL was stuck, and the bus cleared */
+  uint16_t other;
+} twi_errors;
+
+#if RTC_SQW
+/* RTC second edges seen by the SQW interrupt and not yet handled */
+static volatile uint8_t sqw_edges;
+/* Tick count at the latest SQW edge */
+static volatile uint32_t sqw_edge_ticks;
+static uint8_t sqw_level;
+static uint8_t verify_count;
+#endif
+
+/* Sum of the ADC burst in progress, complete at ADC_SAMPLES */
+static volatile uint16_t adc_sum;
+static volatile uint8_t adc_samples;
+/* Moving average of burst sums, and the light band it last fell in */
+static uint16_t light_average;
+static uint8_t light_band;
 
 static uint8_t output_level = 1;
+/* Brightness applied on the way out, 0-255 */
+static uint8_t pixel_level = 2;
 static uint8_t draw_pendulum = 1;
 
 void debug_int(uint32_t value)
 {
   char buf[11];
-  itoa(value, buf, 10);
+  ultoa(value, buf, 10);
   softuart_puts(buf);
 }
 
+ISR (TIM1_OVF_vect)
+{
+  tick_overflows++;
+}
+
+/* Scheduler tick: compare A steps along the free-running count */
 ISR (TIM1_COMPA_vect)
 {
-  millisecond++;
+  OCR1A += SCHED_TICKS;
+  sched_ticks++;
+  sched_due = 1;
 }
 
 void timer_init()
 {
-  OCR1AH = (MILLIS_OVERFLOW >> 8);
-  OCR1AL = (uint8_t)MILLIS_OVERFLOW;
-  /* CTC mode, with /8 prescaler */
-  TCCR1B |= (1 << WGM12) | (1 << CS11);
-  /* interrupt on OCR1A match */
-  TIMSK1 |= (1 << OCIE1A);
+  /* normal mode, free-running with /8 prescaler */
+  TCCR1B |= (1 << CS11);
+  /* interrupt on overflow to extend the count to 32 bits, and for the
+   * scheduler */
+  OCR1A = SCHED_TICKS;
+  TIMSK1 |= (1 << TOIE1) | (1 << OCIE1A);
+}
+
+/* Read the 32-bit tick count. TCNT1 keeps counting while interrupts are off,
+ * so an overflow that hasn't been serviced yet is picked up from TOV1. */
+uint32_t ticks()
+{
+  uint16_t high, low;
+  uint8_t sreg = SREG;
+
+  cli();
+  low = TCNT1;
+  high = tick_overflows;
+  if ((TIFR1 & (1 << TOV1)) && low < 0x8000) {
+    high++;
+  }
+  SREG = sreg;
+  return ((uint32_t)high << 16) | low;
+}
+
+/* Sum a burst of conversions, each one started by the last */
+ISR (ADC_vect)
+{
+  adc_sum += ADC;
+  if (++adc_samples < ADC_SAMPLES) {
+    ADCSRA |= (1 << ADSC);
+  }
 }
 
 void adc_init()
 {
   PRR &= ~(1 << PRADC); /* disable ADC powersave */
-  ADCSRA |= (1 << ADEN); /* enable ADC */
-  ADCSRB |= (1 << ADLAR); /* left-align ADC value, only need 8 bits */
+  /* enable ADC with interrupt, and start the first burst */
+  ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADSC) | ADC_PRESCALE;
 }
 
 void io_init()
 {
   PIXEL_DDR |= (1 << PIXEL_BIT); /* pixel output */
-  BTN_PORT |= (1 << BTN0) | (1 << BTN1) | (1 << BTN2); /* button input with pullup */
 }
 
+/* Lower edge of each light band on the 0-255 scale */
+static const uint8_t light_bands[] = {0, 16, 64, 128, 192};
+#define LIGHT_BANDS (sizeof(light_bands) / sizeof(light_bands[0]))
+
 void update_light_level()
 {
   uint8_t analog_level, light_level;
+  uint8_t band = light_band;
 
-  ADCSRA |= (1 << ADSC);
-  while ( ADCSRA & (1<<ADSC) ) { }
-  analog_level = ADCH;
-
-  /* map 0-255 to 0-3, then to 16, 32, 64, or 128, and 8 as a lower bound */
-  if (analog_level < 16) {
-    light_level = 8;
+  /* take a finished burst and start the next; the ISR is quiet until then */
+  if (adc_samples == ADC_SAMPLES) {
+    /* average over the last four bursts or so */
+    light_average += (int16_t)(adc_sum - light_average) >> 2;
+    adc_sum = 0;
+    adc_samples = 0;
+    ADCSRA |= (1 << ADSC);
   }
-  else {
-    light_level = 1 << (4 + analog_level / 64);
+  analog_level = light_average >> 6;
+
+  /* leave the band only once the reading is well past its edges */
+  if ((band > 0 && analog_level + LIGHT_HYSTERESIS < light_bands[band]) ||
+      (band < LIGHT_BANDS - 1 &&
+       analog_level >= light_bands[band + 1] + LIGHT_HYSTERESIS)) {
+    for (band = LIGHT_BANDS - 1; analog_level < light_bands[band]; band--) { }
+    light_band = band;
   }
 
+  /* bands map to 8 as a lower bound, then 16, 32, 64, or 128 */
+  light_level = band ? 1 << (3 + band) : 8;
+
   /* fade output level between calculated light levels */
   if(output_level < light_level) { output_level++; }
   else if(output_level > light_level) { output_level--; }
+  pixel_level = output_level < 128 ? output_level << 1 : 255;
 }
 
-/* Retrieve the adjusted millisecond value, taking calculated inaccuracy into
- * account by stretching the calculated milliseconds to fit a full second */
-uint16_t millis() {
-  uint16_t ms = (uint32_t)millisecond * 1000 / prev_max_ms;
-  if (ms > 1000) {
-    ms = 1000; /* stretching can go too far */
+/* 1024-step phase since the last RTC second edge, stretched to fit the
+ * measured length of a second:
+ * (elapsed / 2^PHASE_SHIFT) * (2^31 / second_ticks) / 2^(21 - PHASE_SHIFT).
+ * Holds at the end of the second if the next edge is late. */
+uint16_t subsecond_phase() {
+  uint32_t elapsed = ticks() - second_start;
+  if (elapsed >= second_ticks) {
+    return PHASE_ONE - 1;
   }
-  return ms;
+  return ((uint32_t)(uint16_t)(elapsed >> PHASE_SHIFT) * second_scale)
+      >> (21 - PHASE_SHIFT);
 }
 
-/* Keep millisecond count updated based on the last-retrieved second.
- * Tracks the difference between the RTC and internal millisecond counter.
- * When interrupts aren't disabled, the millis timer is accurate to about 950ms
- * out of every second. When interrupts are disabled while writing to the
- * WS2812B pixels, it's closer to 800ms/sec, and with a 15ms delay each
- * iteration of the main loop, it's closer to 900ms/sec. Even at 800ms/sec, the
- * compensated millis() value makes for smooth interpolation across a second. */
-void update_millis()
+/* Step OSCCAL toward TICKS_PER_SECOND per RTC second, once per TRIM_SECONDS
+ * of them. Bit 7 picks one of two overlapping ranges, and steps stay within
+ * it. Two neighbouring settings on either side of the target give the size of
+ * a step, and the one within half a step of it is as close as OSCCAL gets. A
+ * trim that's in tolerance is saved for the next boot. */
+void trim_oscillator(uint32_t now)
 {
-  if (prev_second != second) {
-    prev_second = second;
-    prev_max_ms = (millisecond + prev_max_ms) / 2; /* smooth it a bit */
-    millisecond = 0;
+  int32_t error;
+  uint32_t distance, tolerance;
+  uint8_t cal = OSCCAL;
+
+  if (trim_edges++ == 0) {
+    trim_start = now;
+    return;
+  }
+  if (trim_edges <= TRIM_SECONDS) {
+    return;
+  }
+  error = (int32_t)(now - trim_start - TRIM_TICKS);
+  trim_start = now;
+  trim_edges = 1;
+
+  if (trim_error && (uint8_t)(cal - trim_cal + 1) <= 2 && cal != trim_cal &&
+      (error < 0) != (trim_error < 0)) {
+    trim_step = error < 0 ? trim_error - error : error - trim_error;
+  }
+  trim_error = error;
+  trim_cal = cal;
+
+  distance = error < 0 ? -error : error;
+  tolerance = trim_step / 2 > TRIM_TOLERANCE ? trim_step / 2 : TRIM_TOLERANCE;
+  if (distance <= tolerance) {
+    trim_saving = ((uint16_t)(uint8_t)~cal << 8) | cal;
+    trim_save_bytes = 2;
+  }
+  else if (error > 0) {
+    if (cal & 0x7F) {
+      OSCCAL = cal - 1; /* running fast */
+    }
+  }
+  else if ((cal & 0x7F) != 0x7F) {
+    OSCCAL = cal + 1;
+  }
+}
+
+/* Write out a trim that's waiting, a byte whenever the EEPROM is ready, so
+ * the 3.4ms each takes runs in the background rather than in a task */
+void save_trim()
+{
+  uint8_t i;
+
+  if (trim_save_bytes && eeprom_is_ready()) {
+    i = --trim_save_bytes;
+    eeprom_update_byte((uint8_t *)&saved_trim + i, trim_saving >> (i * 8));
+  }
+}
+
+/* Mark the start of a new RTC second at the given tick count.
+ * Tracks how many local ticks fit in an RTC second, and updates the
+ * reciprocal used by subsecond_phase() so the only divide is once a second.
+ * Intervals far from a second (stalls, or a set_time() in between) are not
+ * counted. */
+void second_edge(uint32_t now)
+{
+  uint32_t elapsed = now - second_start;
+
+  second_start = now;
+  if (elapsed > TICKS_PER_SECOND / 2 && elapsed < TICKS_PER_SECOND * 3 / 2) {
+    second_ticks = (elapsed + second_ticks) / 2; /* smooth it a bit */
+    second_scale = (1UL << 31) / second_ticks;
   }
+  else {
+    trim_edges = 0; /* an edge went missing */
+  }
+  trim_oscillator(now);
 }
 
-uint8_t add_clamped_color(uint8_t current, uint8_t value)
+/* Start from the last good trim, if there is one */
+void trim_init()
 {
-  uint16_t new_value = current + value;
-  if (new_value > 255) {
-    new_value = 255;
+  uint16_t saved = eeprom_read_word(&saved_trim);
+
+  if ((uint8_t)(saved >> 8) == (uint8_t)~saved) {
+    OSCCAL = saved;
   }
-  return (uint8_t)new_value;
+}
+
+/* Buffer offset of each logical pixel, for indexes up to PIXEL_LAYOUT_SIZE.
+ * Generated by the Makefile from the ring's offset, direction or wiring map,
+ * so a lookup is one lpm rather than a software modulo. */
+static const uint8_t layout[PIXEL_LAYOUT_SIZE] PROGMEM = { PIXEL_LAYOUT };
+
+/* Furthest index the hands draw at: each covers two pixels, the second,
+ * minute and hour hands from at most 59, and the pendulum from the end of
+ * its sweep, (EASE_ONE >> 6) * 15 >> 7 = 60 */
+#define LAYOUT_MAX_INDEX (((EASE_ONE >> 6) * 15 >> 7) + 1)
+#if LAYOUT_MAX_INDEX >= PIXEL_LAYOUT_SIZE
+#error "the layout table doesn't reach every pixel the hands draw at"
+#endif
+
+/* Level of the clock face mark at pixel i, a multiple of 5. These come out
+ * at 8/4 at full brightness, and never below 1 once lit; at the lowest light
+ * level only the top mark stays on. */
+uint8_t face_level(uint8_t i) {
+  if (output_level < 8 || (output_level == 8 && i != 0)) {
+    return 0;
+  }
+  if (output_level < 16) {
+    return FACE_DIM;
+  }
+  if (output_level < 32 || i % 15 == 0) {
+    return FACE_MAJOR;
+  }
+  return FACE_MINOR;
+}
+
+#if PIXEL_BITS == 24
+void clear_pixels()
+{
+  uint8_t i;
+  for (i = 0; i < PIXELS*PIXEL_BYTES; i++) {
+    grb[i] = 0;
+  }
+  face_drawn = 0;
+}
+
+/* Note a pixel about to change, with the face level to put back next frame */
+static void mark_dirty(uint8_t offset)
+{
+  uint8_t n;
+
+  if (!face_drawn) {
+    return;
+  }
+  for (n = 0; n < dirty_count; n++) {
+    if (dirty[n].offset == offset) {
+      return;
+    }
+  }
+  if (dirty_count == DIRTY_PIXELS) {
+    face_drawn = 0; /* too many to track, redraw it all */
+    return;
+  }
+  dirty[n].offset = offset;
+  dirty[n].level = grb[offset];
+  dirty_count++;
 }
 
 void set_pixel(uint8_t i, uint8_t r, uint8_t g, uint8_t b)
 {
-  uint8_t offset = ((i + PIXEL_OFFSET) % PIXELS) * 3;
+  uint8_t offset = pgm_read_byte(&layout[i]);
+  mark_dirty(offset);
   grb[offset] = g;
   grb[offset+1] = r;
   grb[offset+2] = b;
 }
 
+/* Draw a color over a pixel with one of the blend.h modes */
+void blend_color(uint8_t i, uint8_t r, uint8_t g, uint8_t b, uint8_t mode)
+{
+  uint8_t offset = pgm_read_byte(&layout[i]);
+  uint8_t color[3] = {g, r, b};
+  mark_dirty(offset);
+  blend(&grb[offset], color, mode);
+}
+#elif PIXEL_BITS == 0
+/* Clock face mark for each physical pixel */
+static const uint8_t face_marks[PIXELS] PROGMEM = { PIXEL_FACE };
+
+void clear_pixels()
+{
+  beam_count = 0;
+  face[FACE_FIVE] = face[FACE_QUARTER] = face[FACE_TOP] = 0;
+}
+
+/* Color of a lit pixel, adding it to the list in order if it's new. Pixels
+ * past BEAM_PIXELS are dropped. */
+static uint8_t *beam_pixel(uint8_t i)
+{
+  uint8_t p = pgm_read_byte(&layout[i]);
+  uint8_t n = beam_count;
+
+  while (n && beam[n-1].pixel > p) {
+    n--;
+  }
+  if (n && beam[n-1].pixel == p) {
+    return beam[n-1].grb;
+  }
+  if (beam_count == BEAM_PIXELS) {
+    return 0;
+  }
+  memmove(&beam[n+1], &beam[n], (beam_count - n) * sizeof(beam[0]));
+  beam_count++;
+  beam[n].pixel = p;
+  beam[n].grb[0] = beam[n].grb[1] = beam[n].grb[2] = 0;
+  return beam[n].grb;
+}
+
+void set_pixel(uint8_t i, uint8_t r, uint8_t g, uint8_t b)
+{
+  uint8_t *color = beam_pixel(i);
+  if (color) {
+    color[0] = g;
+    color[1] = r;
+    color[2] = b;
+  }
+}
+
+/* Draw a color over a pixel with one of the blend.h modes. The face is
+ * added under everything on the way out. */
+void blend_color(uint8_t i, uint8_t r, uint8_t g, uint8_t b, uint8_t mode)
+{
+  uint8_t *pixel = beam_pixel(i);
+  uint8_t color[3] = {g, r, b};
+  if (pixel) {
+    blend(pixel, color, mode);
+  }
+}
+#else
+void clear_pixels()
+{
+  uint8_t i;
+  for (i = 0; i < sizeof(pixel_index); i++) {
+    pixel_index[i] = 0;
+  }
+  palette[0] = palette[1] = palette[2] = 0;
+  palette_count = 1;
+}
+
+static uint8_t get_index(uint8_t p)
+{
+#if PIXEL_BITS == 4
+  uint8_t pair = pixel_index[p >> 1];
+  return (p & 1) ? pair >> 4 : pair & 0x0F;
+#else
+  return pixel_index[p];
+#endif
+}
+
+static void put_index(uint8_t p, uint8_t index)
+{
+#if PIXEL_BITS == 4
+  uint8_t *pair = &pixel_index[p >> 1];
+  if (p & 1) {
+    *pair = (*pair & 0x0F) | (index << 4);
+  }
+  else {
+    *pair = (*pair & 0xF0) | index;
+  }
+#else
+  pixel_index[p] = index;
+#endif
+}
+
+static uint8_t distance(uint8_t a, uint8_t b)
+{
+  return a > b ? a - b : b - a;
+}
+
+/* Palette index for a color, adding it if it's new. Once the palette is
+ * full, colors get the closest entry instead. */
+static uint8_t palette_entry(uint8_t g, uint8_t r, uint8_t b)
+{
+  uint8_t *entry = palette;
+  uint8_t i, best = 0;
+  uint16_t d, best_d = 0xFFFF;
+
+  for (i = 0; i < palette_count; i++, entry += PIXEL_BYTES) {
+    d = distance(entry[0], g) + distance(entry[1], r) + distance(entry[2], b);
+    if (d == 0) {
+      return i;
+    }
+    if (d < best_d) {
+      best_d = d;
+      best = i;
+    }
+  }
+  if (palette_count < PALETTE_SIZE) {
+    entry[0] = g;
+    entry[1] = r;
+    entry[2] = b;
+    return palette_count++;
+  }
+  return best;
+}
+
+/* Drop the palette entries no pixel uses any more, so each streamed frame
+ * has room for its new colors. Pixels keep their colors, for frames that
+ * skip them. */
+void compact_palette()
+{
+  uint8_t remap[PALETTE_SIZE];
+  uint8_t p, i, j, count = 0;
+
+  memset(remap, 0, sizeof(remap));
+  for (p = 0; p < PIXELS; p++) {
+    remap[get_index(p)] = 1;
+  }
+  for (i = 0; i < palette_count; i++) {
+    if (remap[i]) {
+      for (j = 0; j < PIXEL_BYTES; j++) {
+        palette[count * PIXEL_BYTES + j] = palette[i * PIXEL_BYTES + j];
+      }
+      remap[i] = count++;
+    }
+  }
+  palette_count = count;
+
+  for (p = 0; p < PIXELS; p++) {
+    put_index(p, remap[get_index(p)]);
+  }
+}
+
+void set_pixel(uint8_t i, uint8_t r, uint8_t g, uint8_t b)
+{
+  put_index(pgm_read_byte(&layout[i]), palette_entry(g, r, b));
+}
+
+/* Draw a color over a pixel with one of the blend.h modes */
+void blend_color(uint8_t i, uint8_t r, uint8_t g, uint8_t b, uint8_t mode)
+{
+  uint8_t p = pgm_read_byte(&layout[i]);
+  uint8_t *entry = &palette[get_index(p) * PIXEL_BYTES];
+  uint8_t pixel[3] = {entry[0], entry[1], entry[2]};
+  uint8_t color[3] = {g, r, b};
+  blend(pixel, color, mode);
+  put_index(p, palette_entry(pixel[0], pixel[1], pixel[2]));
+}
+#endif
+
 void add_color(uint8_t i, uint8_t r, uint8_t g, uint8_t b)
 {
-  uint8_t offset = ((i + PIXEL_OFFSET) % PIXELS) * 3;
-  grb[offset]   = add_clamped_color(grb[offset], g);
-  grb[offset+1] = add_clamped_color(grb[offset+1], r);
-  grb[offset+2] = add_clamped_color(grb[offset+2], b);
+  blend_color(i, r, g, b, BLEND_ADD);
 }
 
-void write_pixels() {
+/* Start a frame with just the clock face */
+#if PIXEL_BITS == 0
+void begin_frame()
+{
+  clear_pixels();
+  face[FACE_FIVE] = face_level(5);
+  face[FACE_QUARTER] = face_level(15);
+  face[FACE_TOP] = face_level(0);
+}
+#else
+void begin_frame()
+{
+  uint8_t i, level;
+
+#if PIXEL_BITS == 24
+  if (face_drawn && face_drawn_level == output_level) {
+    while (dirty_count) {
+      dirty_count--;
+      i = dirty[dirty_count].offset;
+      level = dirty[dirty_count].level;
+      grb[i] = grb[i+1] = grb[i+2] = level;
+    }
+    return;
+  }
+  dirty_count = 0;
+#endif
+
+  clear_pixels();
+  for (i=0; i<PIXELS; i+=5) {
+    level = face_level(i);
+    add_color(i, level, level, level);
+  }
+
+#if PIXEL_BITS == 24
+  face_drawn = 1;
+  face_drawn_level = output_level;
+#endif
+}
+#endif
+
+/* Set a streamed pixel, ignoring any past the end of the ring */
+void stream_pixel(uint8_t i, uint8_t r, uint8_t g, uint8_t b)
+{
+  if (i < PIXELS) {
+    set_pixel(i, r, g, b);
+  }
+}
+
+/* Gamma 2.2, to a peak of 128. Scaled by pixel_level (2 * output_level)
+ * after the lookup, a full byte comes out at output_level, the old linear
+ * output's peak at every light level. Anything lit looks up at least 1. */
+static const uint8_t gamma_table[256] PROGMEM = {
+    0,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,   1,
+    1,   1,   2,   2,   2,   2,   2,   2,   2,   2,   2,   3,   3,   3,   3,   3,
+    3,   3,   4,   4,   4,   4,   4,   4,   5,   5,   5,   5,   5,   6,   6,   6,
+    6,   6,   7,   7,   7,   7,   7,   8,   8,   8,   8,   9,   9,   9,   9,  10,
+   10,  10,  11,  11,  11,  11,  12,  12,  12,  13,  13,  13,  14,  14,  14,  15,
+   15,  15,  16,  16,  16,  17,  17,  17,  18,  18,  19,  19,  19,  20,  20,  21,
+   21,  21,  22,  22,  23,  23,  23,  24,  24,  25,  25,  26,  26,  27,  27,  28,
+   28,  29,  29,  30,  30,  31,  31,  32,  32,  33,  33,  34,  34,  35,  35,  36,
+   36,  37,  38,  38,  39,  39,  40,  40,  41,  42,  42,  43,  43,  44,  45,  45,
+   46,  47,  47,  48,  48,  49,  50,  50,  51,  52,  52,  53,  54,  55,  55,  56,
+   57,  57,  58,  59,  59,  60,  61,  62,  62,  63,  64,  65,  65,  66,  67,  68,
+   69,  69,  70,  71,  72,  73,  73,  74,  75,  76,  77,  78,  78,  79,  80,  81,
+   82,  83,  84,  84,  85,  86,  87,  88,  89,  90,  91,  92,  93,  93,  94,  95,
+   96,  97,  98,  99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111,
+  112, 113, 114, 115, 116, 117, 118, 119, 120, 121, 123, 124, 125, 126, 127, 128
+};
+
+/* Shift nbytes out to the pixels with interrupts disabled, returning the byte
+ * after them. Pending interrupts run in the gaps between calls while the data
+ * line idles low: the WS2812B only latches after 50us low. Each call keeps
+ * interrupts off for PIXEL_WINDOW_CYCLES(nbytes), which has to stay under a
+ * softuart tick or one gets lost.
+ *
+ * Bytes go out as gamma_table[byte] * pixel_level / 256. Between bytes the
+ * next one is looked up in the gamma table, and while a byte is shifted out
+ * that is multiplied by pixel_level a bit at a time in the slack of each bit
+ * (clc, sbrc/add, ror: shift and add, multiplier bits LSB first). The first
+ * byte is done before interrupts go off. */
+static uint8_t *send_bytes(uint8_t *next, uint8_t nbytes)
+{
+  uint8_t byte, raw, acc;
+  const uint8_t *z;
+  uint8_t sreg = SREG;
+
+  byte = (uint16_t)pgm_read_byte(&gamma_table[*next++]) * pixel_level >> 8;
+
   cli();
   asm volatile(
       "1:"                    "\n\t" /* outer loop: iterate bytes */
-      "ld %[byte], %a[grb]+"  "\n\t"
-      "ldi %[bits], 8"        "\n\t"
-      "2:"                    "\n\t" /* inner loop: write a byte */
+      "ld %[raw], %a[next]+"  "\n\t" /* look up the next byte, */
+      "movw %[z], %[gamma]"   "\n\t"
+      "add %A[z], %[raw]"     "\n\t"
+      "adc %B[z], __zero_reg__" "\n\t"
+      "lpm %[raw], %a[z]"     "\n\t"
+      "clr %[acc]"            "\n\t" /* to scale while this one goes out */
+      ".irp k,0,1,2,3,4,5,6,7" "\n\t" /* write a byte, unrolled */
       "sbi %[port], %[pin]"   "\n\t" /* t = 0 */
+      ".rept %[pad0]"         "\n\t"
+      "nop"                   "\n\t"
+      ".endr"                 "\n\t"
       "sbrs %[byte], 7"       "\n\t" /* 2c if skip, 1c if no skip */
-      "cbi %[port], %[pin]"   "\n\t" /* 2c, t1 = 375ns */
-      "lsl %[byte]"           "\n\t" /* 1c, t = 500 (0) / 375 (1) */
-      "dec %[bits]"           "\n\t" /* 1c, t = 625 (0) / 500 (1) */
-      "nop"                   "\n\t" /* 1c, t = 750 (0) / 625 (1) */
-      "cbi %[port], %[pin]"   "\n\t" /* 2c, t2= 875 (0) / 750 (1) */
-      "brne 2b"               "\n\t" /* 2c if skip, 1c if not */
+      "cbi %[port], %[pin]"   "\n\t" /* 2c, t1 = 3c + pad0 */
+      "clc"                   "\n\t" /* 1c */
+      "sbrc %[level], \\k"    "\n\t" /* 2c either way */
+      "add %[acc], %[raw]"    "\n\t"
+      ".rept %[pad1]"         "\n\t"
+      "nop"                   "\n\t"
+      ".endr"                 "\n\t"
+      "cbi %[port], %[pin]"   "\n\t" /* 2c, t2 = 7c + pad0 + pad1 */
+      "ror %[acc]"            "\n\t" /* 1c */
+      "lsl %[byte]"           "\n\t" /* 1c */
+      ".rept %[padbit]"       "\n\t"
+      "nop"                   "\n\t"
+      ".endr"                 "\n\t" /* period 11c + pads (1), 1c more (0) */
+      ".endr"                 "\n\t"
+      "mov %[byte], %[acc]"   "\n\t" /* the next byte, scaled */
       "dec %[nbytes]"         "\n\t"
       "brne 1b"               "\n\t"
-      :: [nbytes]  "d" (PIXELS * 3)  /* how many pixels to write */
-      ,  [grb]     "w" (grb)         /* pointer to grb byte array */
-      ,  [byte]    "r" (0)
-      ,  [bits]    "r" (8)
-      ,  [port]    "i" (_SFR_IO_ADDR(PIXEL_PORT))
-      ,  [pin]     "i" (PIXEL_BIT)
+      : [nbytes]  "+r" (nbytes)         /* bytes left to send */
+      , [next]    "+e" (next)           /* pointer to the next byte */
+      , [byte]    "+r" (byte)
+      , [raw]     "=&r" (raw)
+      , [acc]     "=&r" (acc)
+      , [z]       "=&z" (z)
+      : [port]    "i" (_SFR_IO_ADDR(PIXEL_PORT))
+      , [pin]     "i" (PIXEL_BIT)
+      , [level]   "r" (pixel_level)
+      , [gamma]   "r" (gamma_table)
+      , [pad0]    "i" (PIXEL_PAD_T0H)
+      , [pad1]    "i" (PIXEL_PAD_T1H)
+      , [padbit]  "i" (PIXEL_PAD_TBIT)
       );
+  SREG = sreg;
+  return next - 1; /* it reads one byte ahead */
+}
+
+#if PIXEL_BITS == 24
+/* Write the pixels out GROUP_BYTES at a time */
+void write_pixels() {
+  uint8_t *next = grb;
+  uint8_t groups = PIXELS * PIXEL_BYTES / GROUP_BYTES;
+
+  do {
+    next = send_bytes(next, GROUP_BYTES);
+  } while (--groups);
+
   _delay_us(10);
-  sei();
 }
+#else
+/* Without a GRB buffer, each pixel's color is worked out before it's sent,
+ * and sent a pixel (or a byte, at high baud rates) at a time */
+#if GROUP_BYTES < PIXEL_BYTES
+#define LOOKUP_BYTES 1
+#else
+#define LOOKUP_BYTES PIXEL_BYTES
+#endif
+
+static void send_pixel(uint8_t *color)
+{
+  uint8_t n = PIXEL_BYTES / LOOKUP_BYTES;
+  do {
+    color = send_bytes(color, LOOKUP_BYTES);
+  } while (--n);
+}
+#endif
+
+#if PIXEL_BITS == 0
+/* Merge the lit pixels with the clock face as they go out */
+void write_pixels() {
+  uint8_t p = 0;
+  uint8_t n = 0;
+  uint8_t level;
+  uint8_t color[PIXEL_BYTES] = {0};
+
+  do {
+    level = face[pgm_read_byte(&face_marks[p])];
+    color[0] = color[1] = color[2] = level;
+    if (n < beam_count && beam[n].pixel == p) {
+      blend_add(color, beam[n].grb);
+      n++;
+    }
+    send_pixel(color);
+  } while (++p < PIXELS);
+
+  _delay_us(10);
+}
+#elif PIXEL_BITS != 24
+void write_pixels() {
+  uint8_t p = 0;
+
+  do {
+    send_pixel(&palette[get_index(p) * PIXEL_BYTES]);
+  } while (++p < PIXELS);
+
+  _delay_us(10);
+}
+#endif
 
 uint8_t bcd_to_dec(uint8_t bcd) {
   return (bcd >> 4) * 10 + (bcd & 0x0F);
@@ -196,55 +1005,193 @@ uint8_t dec_to_bcd(uint8_t dec) {
   return ((dec / 10) << 4) | (dec % 10);
 }
 
-void get_time() {
-  uint8_t xfer[4];
-  uint8_t status;
+/* Count a failed transfer, status 0 if it couldn't be queued */
+void rtc_error(uint8_t status) {
+  uint16_t *count;
 
-  xfer[0] = RTC_ADDR;
-  xfer[1] = 0;
+  switch (status) {
+    case 0:
+      count = &twi_errors.queue;
+      break;
+    case USI_TWI_NO_ACK_ON_ADDRESS:
+    case USI_TWI_NO_ACK_ON_DATA:
+      count = &twi_errors.nack;
+      break;
+    case USI_TWI_BUS_TIMEOUT:
+      count = &twi_errors.timeout;
+      break;
+    default:
+      count = &twi_errors.other;
+      break;
+  }
+  if (*count < 0xFFFF) {
+    (*count)++;
+  }
+}
+
+void report_errors() {
+  softuart_puts_P("twi errors: queue ");
+  debug_int(twi_errors.queue);
+  softuart_puts_P(", nack ");
+  debug_int(twi_errors.nack);
+  softuart_puts_P(", timeout ");
+  debug_int(twi_errors.timeout);
+  softuart_puts_P(", other ");
+  debug_int(twi_errors.other);
+  softuart_puts_P("\r\n");
+}
 
-  if(!USI_TWI_Start_Transceiver_With_Data(xfer, 2)) {
-    status = USI_TWI_Get_State_Info();
-    softuart_puts_P("write: ");
-    softuart_putchar(status + 48);
-    softuart_puts_P("\r\n");
+void time_read(uint8_t status) {
+  read_status = status;
+  time_ticks = ticks();
+  time_state = TIME_READY;
+}
+
+void time_written(uint8_t status) {
+  write_status = status;
+  write_pending = 0;
+  if (status) {
+    time_dirty = 1;
+    dirty_ticks = ticks();
+  }
+}
+
+/* Queue a read of the time from the RTC, picked up by receive_time() */
+void request_time() {
+  if (time_state != TIME_IDLE) {
     return;
   }
 
-  xfer[0] = RTC_ADDR | 1;
-  if(USI_TWI_Start_Transceiver_With_Data(xfer, 4)) {
-    second = bcd_to_dec(xfer[1]);
-    minute = bcd_to_dec(xfer[2]);
-    hour   = bcd_to_dec(xfer[3]);
+  /* write the register pointer, then read back from it after a restart */
+  rtc_time[0] = RTC_ADDR;
+  rtc_time[1] = 0;
+  time_state = TIME_PENDING;
+
+  if (!USI_TWI_Queue_Random_Read(rtc_time, 4, time_read)) {
+    time_state = TIME_IDLE;
   }
-  else {
-    status = USI_TWI_Get_State_Info();
-    softuart_puts_P("read: ");
-    softuart_putchar(status + 48);
-    softuart_puts_P("\r\n");
+}
+
+/* Apply a finished read, returns 1 if the time was updated */
+uint8_t receive_time() {
+  uint8_t discard = discard_time;
+
+  if (write_status) {
+    rtc_error(write_status);
+    write_status = 0;
   }
 
-  update_millis();
+  if (time_state != TIME_READY) {
+    return 0;
+  }
+  time_state = TIME_IDLE;
+  discard_time = 0;
+
+  if (read_status) {
+    rtc_error(read_status);
+    return 0;
+  }
+  if (discard || time_dirty) {
+    return 0; /* read was started before the last set_time(), or since the
+                 time was adjusted */
+  }
+
+  second = bcd_to_dec(rtc_time[1]);
+  minute = bcd_to_dec(rtc_time[2]);
+  hour   = bcd_to_dec(rtc_time[3]);
+  return 1;
 }
 
-void set_time() {
-  uint8_t xfer[5];
-  uint8_t status;
+/* Read the time and wait for it */
+void get_time() {
+  request_time();
+  while (time_state == TIME_PENDING) { }
+  receive_time();
+}
+
+/* Write the time, and the date if one is pending. The RTC restarts its
+ * second when the seconds register is written, so the local one does too.
+ * Returns 0 if the write couldn't be queued, leaving the retry to the caller. */
+uint8_t set_time() {
+  uint8_t size = 5;
+  uint8_t i;
+
+  while (write_pending) { } /* the buffer is still in use */
+
+  rtc_set[0] = RTC_ADDR;
+  rtc_set[1] = 0;
+  rtc_set[2] = dec_to_bcd(second);
+  rtc_set[3] = dec_to_bcd(minute);
+  rtc_set[4] = dec_to_bcd(hour); /* 0 in bit 6 means 24-hour, which is fine */
+  if (date_pending) {
+    date_pending = 0;
+    for (i = 0; i < 4; i++) {
+      rtc_set[size++] = rtc_date[i];
+    }
+  }
+
+  if (time_state != TIME_IDLE) {
+    discard_time = 1;
+  }
+#if RTC_SQW
+  cli();
+  sqw_edges = 0; /* from the RTC's old second */
+  sei();
+#endif
+
+  write_pending = 1;
+  time_dirty = 0;
+  if (!USI_TWI_Queue_Transceiver_With_Data(rtc_set, size, time_written)) {
+    write_pending = 0;
+    date_pending = size > 5;
+    rtc_error(0);
+    return 0;
+  }
+  second_start = ticks();
+  trim_edges = 0; /* not an RTC edge */
+  return 1;
+}
+
+/* Note a change to the local time, for flush_time() to write later */
+void adjust_time() {
+  cli();
+  time_dirty = 1;
+  dirty_ticks = ticks();
+  sei();
+}
+
+/* Write adjusted time once it has settled */
+void flush_time() {
+  uint32_t since;
+
+  cli();
+  since = ticks() - dirty_ticks;
+  sei();
+  if (time_dirty && since >= RTC_WRITE_DELAY) {
+    prev_second = second;
+    if (!set_time()) {
+      adjust_time(); /* try again after another RTC_WRITE_DELAY */
+    }
+  }
+}
+
+/* Turn on the RTC's 1Hz square wave, and watch for it on the SQW pin */
+void rtc_init() {
+  uint8_t xfer[3];
 
   xfer[0] = RTC_ADDR;
-  xfer[1] = 0;
-  xfer[2] = dec_to_bcd(second);
-  xfer[3] = dec_to_bcd(minute);
-  xfer[4] = dec_to_bcd(hour); /* 0 in bit 6 means 24-hour, which is fine */
-
-  if(!USI_TWI_Start_Transceiver_With_Data(xfer, 5)) {
-    status = USI_TWI_Get_State_Info();
-    softuart_puts_P("write: ");
-    softuart_putchar(status + 48);
-    softuart_puts_P("\r\n");
-    return;
+  xfer[1] = RTC_CONTROL;
+  xfer[2] = RTC_SQW_1HZ;
+
+  if(!USI_TWI_Start_Transceiver_With_Data(xfer, 3)) {
+    rtc_error(USI_TWI_Get_State_Info());
   }
-  millisecond = 0;
+
+#if RTC_SQW
+  SQW_PORT |= (1 << SQW_BIT); /* open drain output, needs the pullup */
+  PCMSK0 |= (1 << SQW_BIT);
+  GIMSK |= (1 << PCIE0);
+#endif
 }
 
 void change_hour(direction dir) {
@@ -293,154 +1240,424 @@ void change_minute(direction dir) {
   }
 }
 
-void update_buttons()
+void advance_second() {
+  if (second == 59) {
+    change_minute(UP); /* clears seconds */
+  }
+  else {
+    second++;
+  }
+}
+
+/* Pin changes on port A: the RTC's SQW output and the softuart RX pin */
+ISR (PCINT0_vect)
 {
-  uint8_t pressed = !(BTN_PINS & (1 << BTN0));
-  if(!btn0_pressed && pressed) {
-    btn0_pressed = 1;
-    mode = ALT;
-    draw_pendulum = !draw_pendulum;
+#if RTC_SQW
+  /* The seconds register updates on the falling edge of the 1Hz output */
+  uint8_t level = SQW_PINS & (1 << SQW_BIT);
+  if (sqw_level && !level) {
+    sqw_edge_ticks = ticks();
+    sqw_edges++;
   }
-  else if(btn0_pressed && !pressed) {
-    btn0_pressed = 0;
-    mode = CLOCK;
+  sqw_level = level;
+#endif
+#if SOFTUART_EDGE_TRIGGERED
+  softuart_rx_edge();
+#endif
+}
+
+#if RTC_SQW
+
+/* Count local seconds from the SQW edges, checking them against the RTC
+ * at a second boundary every RTC_VERIFY_SECONDS */
+void sync_time()
+{
+  uint8_t edges;
+  uint32_t edge;
+
+  if (set_pending) {
+    return;
   }
+  flush_time();
+  receive_time();
 
-  pressed = !(BTN_PINS & (1 << BTN1));
-  if(!btn1_pressed && pressed) {
-    btn1_pressed = 1;
+  cli();
+  edges = sqw_edges;
+  sqw_edges = 0;
+  edge = sqw_edge_ticks;
+  sei();
 
-    if(mode == ALT) {
-      change_minute(DOWN);
-    }
-    else {
-      change_hour(DOWN);
-    }
+  if (!edges) {
+    return;
+  }
+  while (edges--) {
+    advance_second();
+  }
+  second_edge(edge);
+
+  if (++verify_count >= RTC_VERIFY_SECONDS && !time_dirty) {
+    verify_count = 0;
+    request_time();
+  }
+}
+#else
+/* Start the next second from Timer1 alone, once the local one has run
+ * late ticks past its end */
+void local_second(uint32_t late)
+{
+  if (ticks() - second_start < second_ticks + late) {
+    return;
+  }
+  second_start += second_ticks;
+  advance_second();
+  prev_second = second;
+  trim_edges = 0; /* not an RTC edge */
+}
+
+/* Poll the RTC only when the local second is about to end, and start the
+ * next second as soon as a read sees its seconds register change. If the
+ * RTC doesn't answer, seconds carry on locally until it does. */
+void sync_time()
+{
+  if (set_pending) {
+    return;
+  }
+  flush_time();
+  if (time_dirty) {
+    local_second(0); /* the RTC has the old time */
+    return;
+  }
+  if (receive_time() && prev_second != second) {
+    prev_second = second;
+    second_edge(time_ticks);
+  }
+  local_second(RTC_LATE);
+  if (subsecond_phase() >= PHASE_ONE - RTC_POLL_WINDOW) {
+    request_time();
+  }
+}
+#endif
+
+/* Two decimal digits as BCD, and as a number */
+#define DIGITS_BCD(d) (((d)[0] << 4) | (d)[1])
+#define DIGITS_DEC(d) ((d)[0] * 10 + (d)[1])
+
+/* Take the time from a complete set command, as of when its last digit
+ * arrived. The host sent it the given milliseconds past its second (taken
+ * as 0 without them, so a host that truncates is up to a second behind),
+ * and each byte since then took BYTE_TICKS to arrive, so that second
+ * started that long before. The RTC gets written at the start of
+ * the next one, since writing its seconds restarts its countdown. */
+void apply_time_command(uint8_t digits)
+{
+  uint8_t *d = command_digits;
+  uint32_t late = (digits + 1) * BYTE_TICKS; /* 'T' and the digits */
 
-    set_time();
+  if (DIGITS_DEC(d+2) < 1 || DIGITS_DEC(d+2) > 12 ||
+      DIGITS_DEC(d+4) < 1 || DIGITS_DEC(d+4) > 31 ||
+      d[6] < 1 || d[6] > 7 ||
+      DIGITS_DEC(d+7) > 23 || DIGITS_DEC(d+9) > 59 || DIGITS_DEC(d+11) > 59) {
+    softuart_puts_P("bad time\r\n");
+    return;
   }
-  else if(btn1_pressed && !pressed) {
-    btn1_pressed = 0;
+
+  rtc_date[0] = d[6];
+  rtc_date[1] = DIGITS_BCD(d+4);
+  rtc_date[2] = DIGITS_BCD(d+2);
+  rtc_date[3] = DIGITS_BCD(d);
+  date_pending = 1;
+
+  hour   = DIGITS_DEC(d+7);
+  minute = DIGITS_DEC(d+9);
+  second = DIGITS_DEC(d+11);
+  if (digits == TIME_DIGITS_MS) {
+    late += (d[13] * 100 + d[14] * 10 + d[15]) * (TICKS_PER_SECOND / 1000);
+  }
+  while (late >= TICKS_PER_SECOND) {
+    late -= TICKS_PER_SECOND;
+    advance_second();
   }
 
-  pressed = !(BTN_PINS & (1 << BTN2));
-  if(!btn2_pressed && pressed) {
-    btn2_pressed = 1;
+  second_start = command_ticks - late;
+  prev_second = second;
+  set_pending = 1;
+}
 
-    if(mode == ALT) {
-      change_minute(UP);
+/* Parse a byte of a time set command without waiting for the rest */
+void parse_command(uint8_t c, uint32_t now)
+{
+  if (c == COMMAND_TIME) {
+    command_len = 0;
+    return;
+  }
+  if (c == COMMAND_ERRORS) {
+    report_errors();
+    command_len = 0xFF;
+    return;
+  }
+#if PROFILE
+  if (c == COMMAND_PROFILE) {
+    profile_report();
+    command_len = 0xFF;
+    return;
+  }
+#endif
+  if (command_len == 0xFF) {
+    return;
+  }
+
+  if (c >= '0' && c <= '9') {
+    command_digits[command_len++] = c - '0';
+    command_ticks = now;
+    if (command_len < TIME_DIGITS_MS) {
+      return;
     }
-    else {
-      change_hour(UP);
+  }
+  if (command_len == TIME_DIGITS || command_len == TIME_DIGITS_MS) {
+    apply_time_command(command_len);
+  }
+  command_len = 0xFF;
+}
+
+/* Handle received bytes: pixel frames, or commands. Stream mode starts with
+ * the first frame, and the clock comes back once frames stop arriving. */
+void update_serial()
+{
+  uint8_t c;
+
+  while (softuart_kbhit()) {
+    c = softuart_getchar();
+    switch (stream_decode(c)) {
+      case STREAM_IGNORED:
+        parse_command(c, ticks());
+        break;
+      case STREAM_STARTED:
+        if (mode != SERIAL) {
+          clear_pixels();
+          shown_valid = 0;
+          mode = SERIAL;
+          stream_ticks = ticks();
+        }
+#if PIXEL_BITS == 8 || PIXEL_BITS == 4
+        else {
+          compact_palette();
+        }
+#endif
+        break;
+      case STREAM_FRAME:
+        write_pixels();
+        stream_ticks = ticks();
+        break;
     }
+  }
 
-    set_time();
+  if (mode == SERIAL &&
+      ticks() - stream_ticks > STREAM_TIMEOUT_SECONDS * TICKS_PER_SECOND) {
+    stream_reset();
+    mode = CLOCK;
   }
-  else if(btn2_pressed && !pressed) {
-    btn2_pressed = 0;
+
+  /* a day boundary here leaves the date a day behind until it is set again.
+   * If the write can't be queued, try again on the next second, which keeps
+   * it on the boundary the milliseconds put it on. */
+  if (set_pending && ticks() - second_start >= TICKS_PER_SECOND) {
+    advance_second();
+    if (set_time()) {
+      set_pending = 0;
+    }
+    else {
+      second_start += TICKS_PER_SECOND;
+    }
   }
 }
 
-void show_time() {
-  uint8_t i;
-  uint16_t ms = millis();
+void update_buttons()
+{
+  uint8_t event;
 
+  buttons_update();
+  while ((event = button_event()) != BUTTON_NONE) {
+    switch (event) {
+      case BUTTON_PRESS | BTN_MODE:
+        mode = ALT;
+        draw_pendulum = !draw_pendulum;
+        break;
+      case BUTTON_RELEASE | BTN_MODE:
+        mode = CLOCK;
+        break;
+      case BUTTON_PRESS | BTN_DOWN:
+      case BUTTON_REPEATS | BTN_DOWN:
+        if (mode == ALT) {
+          change_minute(DOWN);
+        }
+        else {
+          change_hour(DOWN);
+        }
+        adjust_time();
+        break;
+      case BUTTON_PRESS | BTN_UP:
+      case BUTTON_REPEATS | BTN_UP:
+        if (mode == ALT) {
+          change_minute(UP);
+        }
+        else {
+          change_hour(UP);
+        }
+        adjust_time();
+        break;
+    }
+  }
+}
+
+void show_time() {
+  PROFILE_BEGIN(start);
+  uint16_t phase = subsecond_phase();
+  struct frame f;
   uint16_t level;
-  uint8_t hour_pos;
-  uint32_t pendulum;
-  uint16_t period_ms;
   uint8_t pendulum_pos;
 
-  /* clear the clock face */
-  for(i=0; i<(PIXELS*3); i++) {
-    grb[i] = 0;
-  }
+  f.second = second;
+  f.minute = minute;
+  f.output_level = output_level;
+  f.draw_pendulum = draw_pendulum;
 
-  /* second hand: quadratic ease in-out */
-  /* first half:  y = (x/500)*(x/500)*64 */
-  /* second half: y = 128 - ((x-1000)/500)*(x-1000)/500)*64 */
-  if (ms < 500) {
-    level = (uint32_t)64 * ms * ms * output_level / 500 / 500 / 128;
-  }
-  else {
-    /* should be (ms - 1000) but the signs cancel so keep it positive */
-    level = output_level - (uint32_t)64 * (1000-ms) * (1000-ms) * output_level / 500 / 500 / 128;
-  }
-  add_color(second, 0, 0, output_level - level);
-  add_color(second + 1, 0, 0, level);
+  /* second hand: ease in-out across the second, 0..255 */
+  f.second_level = ease_in_out(phase) >> 7;
 
-  /* minute hand */
-  /* 60000 ms -> 128 levels, LCM is 240000: 60k * 4, 128 * 1875 */
-  level = (uint32_t)(second * 1000 + ms) * 4 / 1875 * output_level / 128;
-  add_color(minute, 0, output_level - level, 0);
-  add_color(minute + 1, 0, level, 0);
+  /* minute hand: 256 levels across the minute */
+  f.minute_level = minute_sweep(second, phase) >> 7;
 
   /* hour hand */
   /* know the current hour, but need to interpolate across a 5-minute span */
-  /* 3600 sec -> 640 level (128 * 5), LCM 28800: 3600 * 8, 640 * 45 */
-  level = ((uint32_t)(minute * 60 + second)) * 8 / 45;
-  hour_pos = hour * 5 + level / 128;
-  level = SCALE(level % 128);
-  add_color(hour_pos, output_level - level, 0, 0);
-  add_color(hour_pos + 1, level, 0, 0);
+  /* 640 levels (128 * 5) across the hour: sweep * 5 / 256 */
+  level = ((hour_sweep(minute, second) >> 6) * 5) >> 2;
+  f.hour_pos = (hour % 12) * 5 + (level >> 7); /* up to 59 */
+  f.hour_level = (level & 127) << 1;
 
   /* pendulum */
-  /* 128 levels * 30 pixels = 3840 */
-  /* using y=x^2 instead of cosine so no floating point is needed */
-  /* y = (x/half_period)^2 * 3840 for first half */
-  /* y = 3840*2 - ((x-period)/half_period)^2 * 3840 for second half */
-  /* try and preserve precision but don't overflow 32 bytes */
-  period_ms = (ms + (second * 1000)) % PENDULUM_PERIOD;
-  if (period_ms <= HALF_PERIOD) {
-    pendulum = (uint32_t)period_ms * period_ms;
-  }
-  else {
-    pendulum = (uint32_t)period_ms - PENDULUM_PERIOD;
-    pendulum = pendulum * pendulum;
-  }
-  pendulum = pendulum / (uint32_t)HALF_PERIOD;
-  pendulum = pendulum * (uint32_t)3840;
-  pendulum = pendulum / (uint32_t)HALF_PERIOD;
-  if (period_ms > HALF_PERIOD) {
-    pendulum = (uint32_t)3840*2 - pendulum;
-  }
-  pendulum_pos = pendulum / 128;
-  /* 128 --> 48/24 (3/8 and 3/16 multipliers) */
-  level = (pendulum - pendulum_pos * 128) * 3 / 8;
+  /* 128 levels * 30 pixels = 3840 per half period, 7680 for a full sweep */
+  /* eased across a 4 second period: 4096 phase steps, or 1024 after >> 2 */
+  /* 7680 / EASE_ONE = 15 / 64 */
+  f.pendulum = 0;
   if (draw_pendulum) {
-    add_color(pendulum_pos, SCALE(48 - level), SCALE(24 - level / 2), 0);
-    add_color(pendulum_pos + 1, SCALE(level), SCALE(level / 2), 0);
+    f.pendulum = ((second & 3) << (PHASE_BITS - 2)) | (phase >> 2);
+    f.pendulum = (ease_in_out(f.pendulum) >> 6) * 15;
   }
 
-  /* clock face */
-  /* with output levels at 16, 32, 64, or 128: should be 8/4 at 128, 4/2 at 64 */
-  for (i=0; i<PIXELS; i+=5) {
-    level = output_level / ((i % 15 == 0) ? 16 : 32);
-    if(level == 0 && ( output_level > 8 || ( output_level == 8 && i == 0 ) ) ) {
-      level = 1;
-    }
-    add_color(i, level, level, level);
+  if (shown_valid && !memcmp(&f, &shown, sizeof(f))) {
+    return;
   }
+  shown = f;
+  shown_valid = 1;
+
+  /* the clock face, with last frame's hands cleared off it */
+  begin_frame();
+
+  blend_color(second, 0, 0, 255 - f.second_level, HAND_BLEND);
+  blend_color(second + 1, 0, 0, f.second_level, HAND_BLEND);
+
+  blend_color(minute, 0, 255 - f.minute_level, 0, HAND_BLEND);
+  blend_color(minute + 1, 0, f.minute_level, 0, HAND_BLEND);
 
+  blend_color(f.hour_pos, 255 - f.hour_level, 0, 0, HAND_BLEND);
+  blend_color(f.hour_pos + 1, f.hour_level, 0, 0, HAND_BLEND);
+
+  if (draw_pendulum) {
+    pendulum_pos = f.pendulum >> 7;
+    /* 128 --> 160/120 (5/4 and 15/16 multipliers), 48/24 after gamma */
+    level = f.pendulum & 127;
+    blend_color(pendulum_pos, ((128 - level) * 5) >> 2,
+                ((128 - level) * 15) >> 4, 0, PENDULUM_BLEND);
+    blend_color(pendulum_pos + 1, (level * 5) >> 2, (level * 15) >> 4, 0,
+                PENDULUM_BLEND);
+  }
+  PROFILE_END(PROFILE_DRAW, start);
+
+#if PROFILE
+  start = ticks();
+#endif
   write_pixels();
+  PROFILE_END(PROFILE_WRITE, start);
+}
+
+/* Draw a frame, unless serial frames are showing */
+void render()
+{
+  if (mode != SERIAL) {
+    show_time();
+  }
+}
+
+/* What runs when: the light level changes slowly, buttons want ~10ms
+ * response, the RTC only needs checking near the end of each second, and
+ * rendering gets the frame rate. Phases spread them across ticks. Keep the
+ * order of the profiler's stages (see profile.h). */
+static struct task tasks[] = {
+  TASK(render,             SCHED_HZ / FRAME_RATE, 0, US_TICKS(5000)),
+  TASK(update_buttons,     SCHED_HZ / 100,        1, US_TICKS(100)),
+  TASK(sync_time,          SCHED_HZ / 20,         3, US_TICKS(300)),
+  TASK(update_light_level, SCHED_HZ / 10,         7, US_TICKS(200)),
+};
+#define TASKS (sizeof(tasks) / sizeof(tasks[0]))
+
+void run_tasks()
+{
+  uint16_t now;
+#if PROFILE
+  uint16_t start = ticks();
+#endif
+
+  cli();
+  now = sched_ticks;
+  sched_due = 0;
+  sei();
+
+  sched_run(tasks, TASKS, now);
+#if PROFILE
+  profile_loop((uint16_t)ticks() - start);
+#endif
+}
+
+/* Sleep until an interrupt, unless there's already something to do */
+void idle()
+{
+  cli();
+  if (!sched_due && !softuart_kbhit()) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
 }
 
 int main(void)
 {
+  trim_init();
   io_init();
+  buttons_init();
   adc_init();
   USI_TWI_Master_Initialise();
   softuart_init();
   timer_init();
+  set_sleep_mode(SLEEP_MODE_IDLE);
   sei();
 
   softuart_puts_P( "time begins.\r\n" );
 
+  rtc_init();
+  get_time();
+
   while(1) {
-    update_light_level();
-    update_buttons();
-    get_time();
-    show_time();
+    update_serial();
+    save_trim();
+    if (sched_due) {
+      run_tasks();
+    }
+    /* a pending time set has to land on its second, so keep checking */
+    if (!set_pending) {
+      idle();
+    }
   }
 
   return 0;
@@ -0,0 +1,120 @@
+/* Name: profile.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include "profile.h"
+
+#if PROFILE
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "softuart.h"
+
+/* Timer1 runs at F_CPU/8 */
+#define TICK_CYCLES 8
+
+struct stage {
+  uint16_t min;
+  uint16_t max;
+  uint32_t total;
+  uint16_t count;
+  uint8_t overruns;
+};
+
+static struct stage stages[PROFILE_STAGES];
+static uint16_t buckets[PROFILE_BUCKETS];
+
+static const char name_render[] PROGMEM = "render";
+static const char name_buttons[] PROGMEM = "buttons";
+static const char name_sync[] PROGMEM = "sync";
+static const char name_light[] PROGMEM = "light";
+static const char name_draw[] PROGMEM = "draw";
+static const char name_write[] PROGMEM = "write";
+static const char * const names[PROFILE_STAGES] PROGMEM = {
+  name_render, name_buttons, name_sync, name_light, name_draw, name_write
+};
+
+void profile_stage(uint8_t stage, uint16_t elapsed)
+{
+  struct stage *s = &stages[stage];
+
+  if (s->count == 0 || elapsed < s->min) {
+    s->min = elapsed;
+  }
+  if (elapsed > s->max) {
+    s->max = elapsed;
+  }
+  /* halve the running total rather than overflow, keeping the average */
+  if (s->count == 0xFFFF) {
+    s->count >>= 1;
+    s->total >>= 1;
+  }
+  s->count++;
+  s->total += elapsed;
+}
+
+void profile_loop(uint16_t elapsed)
+{
+  uint8_t i;
+
+  for (i = 0; i < PROFILE_BUCKETS - 1; i++) {
+    if (elapsed < (PROFILE_BUCKET_TICKS << i)) {
+      break;
+    }
+  }
+  if (buckets[i] < 0xFFFF) {
+    buckets[i]++;
+  }
+}
+
+void profile_overruns(uint8_t stage, uint8_t overruns)
+{
+  stages[stage].overruns = overruns;
+}
+
+void profile_report(void)
+{
+  struct stage *s;
+  uint8_t i;
+
+  softuart_puts_P("cycles: min avg max count, then task overruns since boot\r\n");
+  for (i = 0; i < PROFILE_STAGES; i++) {
+    s = &stages[i];
+    softuart_puts_p(pgm_read_ptr(&names[i]));
+    softuart_putchar(' ');
+    debug_int((uint32_t)s->min * TICK_CYCLES);
+    softuart_putchar(' ');
+    debug_int(s->count ? s->total * TICK_CYCLES / s->count : 0);
+    softuart_putchar(' ');
+    debug_int((uint32_t)s->max * TICK_CYCLES);
+    softuart_putchar(' ');
+    debug_int(s->count);
+    if (i < PROFILE_TASKS) {
+      softuart_putchar(' ');
+      debug_int(s->overruns);
+    }
+    softuart_puts_P("\r\n");
+  }
+
+  softuart_puts_P("loop cycles under:");
+  for (i = 0; i < PROFILE_BUCKETS; i++) {
+    softuart_putchar(' ');
+    if (i < PROFILE_BUCKETS - 1) {
+      debug_int((uint32_t)(PROFILE_BUCKET_TICKS << i) * TICK_CYCLES);
+    }
+    else {
+      softuart_puts_P("more");
+    }
+    softuart_putchar(':');
+    debug_int(buckets[i]);
+  }
+  softuart_puts_P("\r\n");
+
+  memset(stages, 0, sizeof(stages));
+  memset(buckets, 0, sizeof(buckets));
+}
+
+#endif
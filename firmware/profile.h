@@ -0,0 +1,56 @@
+/* Name: profile.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/* Build with PROFILE=1 to time each stage of the main loop against Timer1.
+ * Without it, none of this takes any code or RAM. */
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+/* Timed stages. The scheduled tasks come first, in task table order, up to
+ * PROFILE_TASKS. */
+enum {
+  PROFILE_RENDER,
+  PROFILE_BUTTONS,
+  PROFILE_SYNC,
+  PROFILE_LIGHT,
+  PROFILE_TASKS,
+  PROFILE_DRAW = PROFILE_TASKS, /* show_time() up to writing the pixels */
+  PROFILE_WRITE,  /* write_pixels() */
+  PROFILE_STAGES
+};
+
+/* Scheduler passes are counted in buckets by how long they took: under 64
+ * Timer1 ticks, under 128, and so on, with the last taking the rest */
+#define PROFILE_BUCKETS 8
+#define PROFILE_BUCKET_TICKS 64
+
+#if PROFILE
+#define PROFILE_BEGIN(start) uint16_t start = ticks()
+#define PROFILE_END(stage, start) profile_stage(stage, (uint16_t)ticks() - (start))
+
+void profile_stage(uint8_t stage, uint16_t elapsed);
+void profile_loop(uint16_t elapsed);
+/* The scheduler's overrun count for a task, as of its last run */
+void profile_overruns(uint8_t stage, uint8_t overruns);
+
+/* Print the figures so far over serial, in CPU cycles, and start over */
+void profile_report(void);
+#else
+#define PROFILE_BEGIN(start)
+#define PROFILE_END(stage, start)
+#endif
+
+/* Provided by main.c */
+uint32_t ticks(void);
+void debug_int(uint32_t value);
+
+#endif
@@ -0,0 +1,45 @@
+/* Name: sched.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include "sched.h"
+#include "profile.h"
+
+static void overrun(struct task *t)
+{
+  if (t->overruns < 255) {
+    t->overruns++;
+  }
+}
+
+void sched_run(struct task *tasks, uint8_t count, uint16_t now)
+{
+  struct task *t;
+  uint16_t late;
+  uint32_t start, elapsed;
+
+  for (t = tasks; t < tasks + count; t++) {
+    late = now - t->next;
+    if (late & 0x8000) {
+      continue; /* not due yet */
+    }
+    if (late >= t->period) {
+      overrun(t); /* skip the runs it missed */
+      t->next = now;
+    }
+    t->next += t->period;
+
+    start = ticks();
+    t->run();
+    elapsed = ticks() - start;
+    if (elapsed > t->budget) {
+      overrun(t);
+    }
+#if PROFILE
+    profile_stage(t - tasks, elapsed);
+    profile_overruns(t - tasks, t->overruns);
+#endif
+  }
+}
@@ -0,0 +1,33 @@
+/* Name: sched.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+/* A task runs every period scheduler ticks, first at phase. A run that takes
+ * longer than budget (in Timer1 ticks), or starts a whole period late, counts
+ * as an overrun. */
+struct task {
+  void (*run)(void);
+  uint16_t period;
+  uint16_t phase;
+  uint16_t budget;
+  uint16_t next;     /* scheduler tick of the next run */
+  uint8_t overruns;
+};
+
+#define TASK(run, period, phase, budget) \
+  { run, period, phase, budget, phase, 0 }
+
+/* Run whichever tasks are due at scheduler tick now */
+void sched_run(struct task *tasks, uint8_t count, uint16_t now);
+
+/* Provided by main.c */
+uint32_t ticks(void);
+
+#endif
@@ -154,6 +154,11 @@ volatile static unsigned char  qin;
 static unsigned char           qout;
 volatile static unsigned char  flag_rx_off;
 volatile static unsigned char  flag_rx_ready;
+static unsigned char           flag_rx_waiting_for_stop_bit;
+static unsigned char           rx_mask;
+static unsigned char           timer_rx_ctr;
+static unsigned char           bits_left_in_rx;
+static unsigned char           internal_rx_buffer;
 
 // 1 Startbit, 8 Databits, 1 Stopbit = 10 Bits/Frame
 #define TX_NUM_OF_BITS (10)
@@ -162,20 +167,26 @@ volatile static unsigned char  timer_tx_ctr;
 volatile static unsigned char  bits_left_in_tx;
 volatile static unsigned short internal_tx_buffer; /* ! mt: was type uchar - this was wrong */
 
+// Characters waiting to be sent, drained by the ISR
+volatile static char           outbuf[SOFTUART_OUT_BUF_SIZE];
+static unsigned char           outq_in;
+volatile static unsigned char  outq_out;
+static unsigned char           tx_overflows;
+
 #define set_tx_pin_high()      ( SOFTUART_TXPORT |=  ( 1 << SOFTUART_TXBIT ) )
 #define set_tx_pin_low()       ( SOFTUART_TXPORT &= ~( 1 << SOFTUART_TXBIT ) )
 #define get_rx_pin_status()    ( SOFTUART_RXPIN  &   ( 1 << SOFTUART_RXBIT ) )
 
+#define timer_start()          ( SOFTUART_T_CONTR_REGB = SOFTUART_CTC_MASKB | SOFTUART_PRESC_MASKB )
+#define timer_stop()           ( SOFTUART_T_CONTR_REGB = SOFTUART_CTC_MASKB )
+#define timer_running()        ( SOFTUART_T_CONTR_REGB & SOFTUART_PRESC_MASKB )
+
 ISR(SOFTUART_T_COMP_LABEL)
 {
-  static unsigned char flag_rx_waiting_for_stop_bit = SU_FALSE;
-  static unsigned char rx_mask;
-
-  static unsigned char timer_rx_ctr;
-  static unsigned char bits_left_in_rx;
-  static unsigned char internal_rx_buffer;
-
-  unsigned char start_bit, flag_in;
+#if !SOFTUART_EDGE_TRIGGERED
+  unsigned char start_bit;
+#endif
+  unsigned char flag_in;
   unsigned char tmp;
 
   // Transmitter Section
@@ -197,6 +208,19 @@ ISR(SOFTUART_T_COMP_LABEL)
     timer_tx_ctr = tmp;
   }
 
+  // start the next queued character once the stop bit is out
+  if ( flag_tx_busy == SU_FALSE && outq_out != outq_in ) {
+    tmp = outq_out;
+    internal_tx_buffer = ( outbuf[tmp] << 1 ) | 0x200;
+    if ( ++tmp >= SOFTUART_OUT_BUF_SIZE ) {
+      tmp = 0;
+    }
+    outq_out        = tmp;
+    timer_tx_ctr    = 3;
+    bits_left_in_tx = TX_NUM_OF_BITS;
+    flag_tx_busy    = SU_TRUE;
+  }
+
   // Receiver Section
   if ( flag_rx_off == SU_FALSE ) {
     if ( flag_rx_waiting_for_stop_bit ) {
@@ -208,10 +232,16 @@ ISR(SOFTUART_T_COMP_LABEL)
           // overflow - reset inbuf-index
           qin = 0;
         }
+#if SOFTUART_EDGE_TRIGGERED
+        SOFTUART_RX_PCMSK |= ( 1 << SOFTUART_RX_PCINT ); // wait for the next start bit
+#endif
       }
     }
     else {  // rx_test_busy
       if ( flag_rx_ready == SU_FALSE ) {
+#if SOFTUART_EDGE_TRIGGERED
+        ; // start bits are found by softuart_rx_edge()
+#else
         start_bit = get_rx_pin_status();
         // test for start bit
         if ( start_bit == 0 ) {
@@ -221,6 +251,7 @@ ISR(SOFTUART_T_COMP_LABEL)
           bits_left_in_rx    = RX_NUM_OF_BITS;
           rx_mask            = 1;
         }
+#endif
       }
       else {  // rx_busy
         tmp = timer_rx_ctr;
@@ -240,8 +271,41 @@ ISR(SOFTUART_T_COMP_LABEL)
       }
     }
   }
+
+#if SOFTUART_EDGE_TRIGGERED
+  // nothing to do until the next start bit or queued character
+  if ( flag_tx_busy == SU_FALSE && flag_rx_ready == SU_FALSE ) {
+    timer_stop();
+  }
+#endif
 }
 
+#if SOFTUART_EDGE_TRIGGERED
+void softuart_rx_edge( void )
+{
+  if ( flag_rx_off == SU_TRUE || flag_rx_ready == SU_TRUE || get_rx_pin_status() ) {
+    return;
+  }
+  // ignore the data bit edges until the stop bit
+  SOFTUART_RX_PCMSK &= ~( 1 << SOFTUART_RX_PCINT );
+
+  // sample the first data bit 1.5 bits (4.5 timer ticks) after the edge
+  if ( !timer_running() ) {
+    SOFTUART_T_CNT_REG = SOFTUART_TIMERTOP / 2; // first tick half a tick from now
+    SOFTUART_T_INTFLAG_REG = SOFTUART_CMPINT_FLAG_MASK;
+    timer_start();
+  }
+  // ticks already running for the transmitter come 0 to 1 tick from now,
+  // so the fifth lands 4 to 5 ticks after the edge
+  timer_rx_ctr = 5;
+
+  flag_rx_ready      = SU_TRUE;
+  internal_rx_buffer = 0;
+  bits_left_in_rx    = RX_NUM_OF_BITS;
+  rx_mask            = 1;
+}
+#endif
+
 static void io_init(void)
 {
   // TX-Pin as output
@@ -260,12 +324,21 @@ static void timer_init(void)
   SOFTUART_T_COMP_REG = SOFTUART_TIMERTOP;     /* set top */
 
   SOFTUART_T_CONTR_REGA = SOFTUART_CTC_MASKA | SOFTUART_PRESC_MASKA;
-  SOFTUART_T_CONTR_REGB = SOFTUART_CTC_MASKB | SOFTUART_PRESC_MASKB;
+#if SOFTUART_EDGE_TRIGGERED
+  timer_stop(); /* started by a start bit or a queued character */
+#else
+  timer_start();
+#endif
 
   SOFTUART_T_INTCTL_REG |= SOFTUART_CMPINT_EN_MASK;
 
   SOFTUART_T_CNT_REG = 0; /* reset counter */
 
+#if SOFTUART_EDGE_TRIGGERED
+  SOFTUART_RX_PCMSK |= ( 1 << SOFTUART_RX_PCINT );
+  GIMSK |= SOFTUART_RX_PCIE_MASK;
+#endif
+
   SREG = sreg_tmp;
 }
 
@@ -326,21 +399,54 @@ void softuart_flush_input_buffer( void )
 
 unsigned char softuart_transmit_busy( void )
 {
-  return ( flag_tx_busy == SU_TRUE ) ? 1 : 0;
+  return ( flag_tx_busy == SU_TRUE || outq_out != outq_in ) ? 1 : 0;
+}
+
+// Append to the output buffer, the ISR picks it up from there
+static unsigned char tx_enqueue( const char ch )
+{
+  unsigned char next = outq_in + 1;
+
+  if ( next >= SOFTUART_OUT_BUF_SIZE ) {
+    next = 0;
+  }
+  if ( next == outq_out ) {
+    return SU_FALSE;
+  }
+  outbuf[outq_in] = ch;
+  outq_in = next;
+#if SOFTUART_EDGE_TRIGGERED
+  if ( !timer_running() ) {
+    timer_start(); // the ISR picks up the character on its next tick
+  }
+#endif
+  return SU_TRUE;
 }
 
 void softuart_putchar( const char ch )
 {
-  while ( flag_tx_busy == SU_TRUE ) {
-    ; // wait for transmitter ready
-      // add watchdog-reset here if needed;
+  while ( tx_enqueue( ch ) == SU_FALSE ) {
+    idle(); // wait for room in the buffer
   }
+}
+
+unsigned char softuart_try_putchar( const char ch )
+{
+  if ( tx_enqueue( ch ) == SU_FALSE ) {
+    if ( tx_overflows != 0xff ) {
+      tx_overflows++;
+    }
+    return 0;
+  }
+  return 1;
+}
+
+unsigned char softuart_tx_overflows( void )
+{
+  unsigned char count = tx_overflows;
 
-  // invoke_UART_transmit
-  timer_tx_ctr       = 3;
-  bits_left_in_tx    = TX_NUM_OF_BITS;
-  internal_tx_buffer = ( ch << 1 ) | 0x200;
-  flag_tx_busy       = SU_TRUE;
+  tx_overflows = 0;
+  return count;
 }
 
 void softuart_puts( const char *s )
@@ -3,7 +3,9 @@
     #define F_CPU 3686400UL
 #endif
 
+#ifndef SOFTUART_BAUD_RATE
 #define SOFTUART_BAUD_RATE      9600
+#endif
 
 #if defined (__AVR_ATtiny25__) || defined (__AVR_ATtiny45__) || defined (__AVR_ATtiny85__) || defined (__AVR_ATtiny84A__)
     #define SOFTUART_RXPIN   PINA
@@ -20,16 +22,28 @@
     #define SOFTUART_T_CONTR_REGB      TCCR0B
     #define SOFTUART_T_CNT_REG         TCNT0
     #define SOFTUART_T_INTCTL_REG      TIMSK0
+    #define SOFTUART_T_INTFLAG_REG     TIFR0
 
     #define SOFTUART_CMPINT_EN_MASK    (1 << OCIE0A)
+    #define SOFTUART_CMPINT_FLAG_MASK  (1 << OCF0A)
 
     #define SOFTUART_CTC_MASKA         (1 << WGM01)
     #define SOFTUART_CTC_MASKB         (0)
 
+    /* pin change interrupt for start bit detection */
+    #define SOFTUART_RX_PCMSK          PCMSK0
+    #define SOFTUART_RX_PCINT          PCINT1
+    #define SOFTUART_RX_PCIE_MASK      (1 << PCIE0)
+
     /* "A timer interrupt must be set to interrupt at three times
        the required baud rate." */
-    #define SOFTUART_PRESCALE (8)
-    // #define SOFTUART_PRESCALE (1)
+    /* no prescaler when the compare value fits in 8 bits, for less
+       rounding error at higher baud rates */
+    #if (F_CPU / SOFTUART_BAUD_RATE / 3 <= 256)
+        #define SOFTUART_PRESCALE (1)
+    #else
+        #define SOFTUART_PRESCALE (8)
+    #endif
 
     #if (SOFTUART_PRESCALE == 8)
         #define SOFTUART_PRESC_MASKA         (0)
@@ -65,8 +79,13 @@
 
     /* "A timer interrupt must be set to interrupt at three times
        the required baud rate." */
-    #define SOFTUART_PRESCALE (8)
-    // #define SOFTUART_PRESCALE (1)
+    /* no prescaler when the compare value fits in 8 bits, for less
+       rounding error at higher baud rates */
+    #if (F_CPU / SOFTUART_BAUD_RATE / 3 <= 256)
+        #define SOFTUART_PRESCALE (1)
+    #else
+        #define SOFTUART_PRESCALE (8)
+    #endif
 
     #if (SOFTUART_PRESCALE == 8)
         #define SOFTUART_PRESC_MASKA         (0)
@@ -87,7 +106,19 @@
     #warning "Check SOFTUART_TIMERTOP: increase prescaler, lower F_CPU or use a 16 bit timer"
 #endif
 
+/* Run the timer only while a character is being received or sent.
+   A pin change interrupt on the RX pin detects the start bit, and the
+   application's ISR for it has to call softuart_rx_edge(). */
+#ifndef SOFTUART_EDGE_TRIGGERED
+    #define SOFTUART_EDGE_TRIGGERED 1
+#endif
+
+#if SOFTUART_EDGE_TRIGGERED && !defined(SOFTUART_RX_PCMSK)
+    #error "no pin change interrupt defined for the RX pin of this AVR"
+#endif
+
 #define SOFTUART_IN_BUF_SIZE     24
+#define SOFTUART_OUT_BUF_SIZE    32
 
 // Init the Software Uart
 void softuart_init(void);
@@ -101,12 +132,25 @@ unsigned char softuart_kbhit( void );
 // Reads a character from the input buffer, waiting if necessary.
 char softuart_getchar( void );
 
-// To check if transmitter is busy
+// To check if transmitter is busy or has characters queued
 unsigned char softuart_transmit_busy( void );
 
-// Writes a character to the serial port.
+// Queues a character for the serial port, waiting only if the
+// output buffer is full.
 void softuart_putchar( const char );
 
+// Queues a character without waiting. Returns 0 and drops the
+// character if the output buffer is full.
+unsigned char softuart_try_putchar( const char );
+
+// Number of characters dropped by softuart_try_putchar() since
+// the last call.
+unsigned char softuart_tx_overflows( void );
+
+// Starts receiving a character if the RX pin change was a start
+// bit. Call from the pin change ISR in edge triggered mode.
+void softuart_rx_edge( void );
+
 // Turns on the receive function.
 void softuart_turn_rx_on( void );
 
@@ -0,0 +1,77 @@
+/* Name: stream.c
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#include "stream.h"
+
+static enum {IDLE, OPCODE, COLOR} state = IDLE;
+static uint8_t op;
+static uint8_t count;    /* pixels left in the current opcode */
+static uint8_t cursor;   /* next pixel to write, stops at CURSOR_END */
+static uint8_t channel;  /* which byte of the color comes next */
+static uint8_t color[3]; /* g, r, b */
+
+#define CURSOR_END 0xFF
+
+/* Write the color at the cursor, returns 1 when the opcode is done */
+static uint8_t put_color()
+{
+  stream_pixel(cursor, color[1], color[0], color[2]);
+  if (cursor != CURSOR_END) {
+    cursor++;
+  }
+  return --count == 0;
+}
+
+/* Decode one byte of the stream, writing pixels as they complete */
+uint8_t stream_decode(uint8_t byte)
+{
+  switch (state) {
+    case IDLE:
+      if (byte != STREAM_START) {
+        return STREAM_IGNORED;
+      }
+      state = OPCODE;
+      cursor = 0;
+      return STREAM_STARTED;
+
+    case OPCODE:
+      op = byte & STREAM_OP;
+      count = (byte & STREAM_COUNT) + 1;
+      if (op == STREAM_END) {
+        state = IDLE;
+        return STREAM_FRAME;
+      }
+      if (op == STREAM_SKIP) {
+        cursor = cursor > CURSOR_END - count ? CURSOR_END : cursor + count;
+      }
+      else {
+        channel = 0;
+        state = COLOR;
+      }
+      return STREAM_BUSY;
+
+    case COLOR:
+      color[channel++] = byte;
+      if (channel < 3) {
+        return STREAM_BUSY;
+      }
+      channel = 0;
+      if (op == STREAM_RUN) {
+        while (!put_color()) { }
+        state = OPCODE;
+      }
+      else if (put_color()) {
+        state = OPCODE;
+      }
+      return STREAM_BUSY;
+  }
+  return STREAM_IGNORED;
+}
+
+void stream_reset()
+{
+  state = IDLE;
+}
@@ -0,0 +1,52 @@
+/* Name: stream.h
+ * Author: Nathan Witmer
+ * Copyright: 2015 Nathan Witmer
+ * License: MIT (see LICENSE)
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+
+/* Pixel frames streamed over serial, decoded straight into the pixel buffer.
+ *
+ * A frame starts with STREAM_START, followed by opcodes that each cover
+ * 1 to 64 pixels from a cursor that starts at pixel 0:
+ *
+ *   00nnnnnn                skip n+1 pixels, leaving them as in the last frame
+ *   01nnnnnn g r b          n+1 pixels of the same color
+ *   10nnnnnn (g r b)...     n+1 literal pixels
+ *   11xxxxxx                end of frame, show it
+ *
+ * Colors are full range, and get the same gamma correction and light level
+ * scaling as the clock's own. Pixels past the end of the ring are ignored,
+ * and the cursor stops at 255 rather than wrapping back to the start.
+ * The first frame after the clock face was showing starts from black. */
+#define STREAM_START 0x02
+
+#define STREAM_SKIP  0x00
+#define STREAM_RUN   0x40
+#define STREAM_RAW   0x80
+#define STREAM_END   0xC0
+#define STREAM_OP    0xC0
+#define STREAM_COUNT 0x3F
+
+/* Stream mode ends after this long without a complete frame */
+#define STREAM_TIMEOUT_SECONDS 2
+
+/* Result of feeding a byte to stream_decode() */
+#define STREAM_IGNORED 0 /* not part of a frame */
+#define STREAM_BUSY    1 /* consumed */
+#define STREAM_STARTED 2 /* new frame started */
+#define STREAM_FRAME   3 /* frame complete, ready to show */
+
+uint8_t stream_decode(uint8_t byte);
+
+/* Drop any partial frame, so the next byte is looked for as STREAM_START */
+void stream_reset(void);
+
+/* Provided by main.c, ignores pixels past the end of the ring */
+void stream_pixel(uint8_t i, uint8_t r, uint8_t g, uint8_t b);
+
+#endif
@@ -0,0 +1,18 @@
+# Name: timestamp.pl
+# Author: Nathan Witmer
+# Copyright: 2015 Nathan Witmer
+# License: MIT (see LICENSE)
+#
+# Prints the serial time set command for `make serial`: T, then
+# yymmddwHHMMSS and the milliseconds past that second, so the clock can
+# take out the part of a second that `date` would truncate.
+#
+#   perl timestamp.pl
+
+use strict;
+use POSIX qw(strftime);
+use Time::HiRes qw(time);
+
+my $now = time;
+printf "T%s%03d", strftime("%y%m%d%u%H%M%S", localtime $now),
+  int(($now - int $now) * 1000);